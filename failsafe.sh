@@ -14,12 +14,17 @@ ar rc fs/libfs.a build/fs/fs.o
 ranlib fs/libfs.a
 gcc -o user/bash -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/bash.o -luser fs/libfs.a
 cp "user/bash" "bash"
+gcc -o build/bundle.o -c -m32 -Wall -DLINUX -Iinclude build/bundle.c
 gcc -o build/debug.o -c -m32 -Wall -DLINUX -Iinclude build/debug.c
+gcc -o build/group.o -c -m32 -Wall -DLINUX -Iinclude build/group.c
+gcc -o build/image.o -c -m32 -Wall -DLINUX -Iinclude build/image.c
 gcc -o build/kernel.o -c -m32 -Wall -DLINUX -Iinclude build/kernel.c
 gcc -o build/load.o -c -m32 -Wall -DLINUX -Iinclude build/load.c
 gcc -o build/memory.o -c -m32 -Wall -DLINUX -Iinclude build/memory.c
+gcc -o build/pipe.o -c -m32 -Wall -DLINUX -Iinclude build/pipe.c
 gcc -o build/process.o -c -m32 -Wall -DLINUX -Iinclude build/process.c
 gcc -o build/schedule.o -c -m32 -Wall -DLINUX -Iinclude build/schedule.c
+gcc -o build/sync.o -c -m32 -Wall -DLINUX -Iinclude build/sync.c
 gcc -o build/user/cat.o -c -m32 -DLINUX -D__ASM__ -Iinclude -Ifs build/user/cat.c
 gcc -o build/user/checkpoint.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/checkpoint.c
 gcc -o build/user/console.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/console.c
@@ -28,6 +33,12 @@ gcc -o build/user/cp.o -c -m32 -DLINUX -D__ASM__ -Iinclude -Ifs build/user/cp.c
 gcc -o build/user/cp1.o -c -m32 -DLINUX -D__ASM__ -Iinclude -Ifs build/user/cp1.c
 gcc -o build/user/cycle.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/cycle.c
 gcc -o build/user/delay.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/delay.c
+gcc -o build/user/threads.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/threads.c
+gcc -o build/user/locks.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/locks.c
+gcc -o build/user/notify.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/notify.c
+gcc -o build/user/select.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/select.c
+gcc -o build/user/group.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/group.c
+gcc -o build/user/ipcstat.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/ipcstat.c
 gcc -o build/user/disk.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/disk.c
 gcc -o build/user/dummy.o -c -m32 -DLINUX -D__ASM__ -Iinclude build/user/dummy.c
 gcc -o build/user/echo.o -c -m32 -DLINUX -D__ASM__ -Iinclude -Ifs build/user/echo.c
@@ -156,6 +167,12 @@ gcc -o user/checkpoint -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/e
 gcc -o user/copy-from-to -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/copy-from-to.o -luser
 gcc -o user/cycle -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/cycle.o -luser
 gcc -o user/delay -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/delay.o -luser
+gcc -o user/threads -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/threads.o -luser
+gcc -o user/locks -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/locks.o -luser
+gcc -o user/notify -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/notify.o -luser
+gcc -o user/select -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/select.o -luser
+gcc -o user/group -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/group.o -luser
+gcc -o user/ipcstat -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/ipcstat.o -luser
 gcc -o user/disk -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/disk.o -luser
 gcc -o user/dummy -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/dummy.o -luser
 gcc -o user/evil -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/evil.o -luser
@@ -181,5 +198,6 @@ gcc -o user/sysv -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/use
 gcc -o user/time -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/time.o -luser
 gcc -o user/walk -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/walk.o -luser fs/libfs.a
 gcc -o user/zero -m32 -static -Wl,-T,/home/cs5460/projects/yalnix/public/etc/user.x -u exit -u __brk -u __sbrk -u __mmap -u __default_morecore -L /home/cs5460/projects/yalnix/public/lib build/user/zero.o -luser fs/libfs.a
-gcc -o yalnix -Wl,-T,/home/cs5460/projects/yalnix/public/etc/kernel.x -Wl,-R/home/cs5460/projects/yalnix/public/lib -m32 build/kernel.o build/memory.o build/debug.o build/load.o build/process.o build/schedule.o -L/home/cs5460/projects/yalnix/public/lib -lkernel -lhardware -lelf
+gcc -o misc/mkbundle -m32 -Wall -DLINUX -Iinclude misc/mkbundle.c
+gcc -o yalnix -Wl,-T,/home/cs5460/projects/yalnix/public/etc/kernel.x -Wl,-R/home/cs5460/projects/yalnix/public/lib -m32 build/kernel.o build/memory.o build/debug.o build/load.o build/process.o build/schedule.o build/image.o build/bundle.o build/sync.o build/pipe.o build/group.o -L/home/cs5460/projects/yalnix/public/lib -lkernel -lhardware -lelf
 cp "user/zero" "zero"
@@ -1,5 +1,7 @@
 #include "fs.h"
 #include "yalnix.h"
+#include "syscalls.h"
+#include "hardware.h"
 #include "filesystem.h"
 
 #include <string.h>
@@ -223,3 +225,87 @@ int IsDirectory( FH_t id ){
 
 	return message.code;
 }
+
+/* ask the file server for a shared memory channel. requests submitted on
+ * it cost no trap until FsRingWait, which tells the server about all of
+ * them with one Doorbell. returns 0 if the server can't make one.
+ */
+struct fs_ring * FsRingOpen(void){
+	struct fs_message_ring message;
+	message.type = RING_OPEN;
+	message.code = ERROR;
+
+	if ( send( &message ) != 0 || message.code != 0 ){
+		return 0;
+	}
+
+	message.ring->server = message.server;
+	return message.ring;
+}
+
+/* give the channel back. requests still on it are lost */
+int FsRingClose( struct fs_ring * ring ){
+	struct fs_message_ring message;
+	message.type = RING_CLOSE;
+	message.code = ERROR;
+	message.ring = ring;
+
+	if ( send( &message ) != 0 || message.code != 0 ){
+		return ERROR;
+	}
+
+	return UnmapShared( ring, (sizeof( struct fs_ring ) + PAGESIZE - 1) / PAGESIZE );
+}
+
+/* put a request on the ring. the bytes of a WRITE are copied right away.
+ * fails if FS_RING_SLOTS requests are waiting for FsRingWait.
+ */
+int FsRingSubmit( struct fs_ring * ring, enum fs_operation type, FH_t file, int count, int offset, char * data ){
+	struct fs_ring_request * request;
+
+	if ( ring->submitted - ring->collected == FS_RING_SLOTS || count < 0 || count > FS_RING_DATA ){
+		return ERROR;
+	}
+
+	request = &ring->slots[ ring->submitted % FS_RING_SLOTS ];
+	request->type = type;
+	request->file = file;
+	request->count = count;
+	request->offset = offset;
+	request->code = ERROR;
+	if ( type == WRITE ){
+		memcpy( request->data, data, count );
+	}
+
+	ring->submitted += 1;
+	return 0;
+}
+
+/* wait for the oldest request that has not been waited for and return its
+ * code. the bytes of a READ go to buffer.
+ */
+int FsRingWait( struct fs_ring * ring, char * buffer ){
+	struct fs_ring_request * request;
+
+	if ( ring->collected == ring->submitted ){
+		return ERROR;
+	}
+
+	if ( ring->announced != ring->submitted ){
+		ring->announced = ring->submitted;
+		if ( Doorbell( ring->server ) == ERROR ){
+			return ERROR;
+		}
+	}
+
+	while ( ring->completed == ring->collected ){
+		FutexWait( &ring->completed, ring->collected );
+	}
+
+	request = &ring->slots[ ring->collected % FS_RING_SLOTS ];
+	if ( request->type == READ && request->code > 0 ){
+		memcpy( buffer, request->data, request->code );
+	}
+	ring->collected += 1;
+	return request->code;
+}
@@ -22,6 +22,8 @@ enum fs_operation{
 	LOOKUP,
 	GET_PATH,
 	IS_DIRECTORY,
+	RING_OPEN,
+	RING_CLOSE,
 };
 
 /*
@@ -140,6 +142,47 @@ struct fs_message_shutdown{
 	int code;
 };
 
+/* requests in flight on one shared memory channel and the bytes each one
+ * can move
+ */
+#define FS_RING_SLOTS 8
+#define FS_RING_DATA 1024
+
+/* a READ, WRITE, STAT, STAMP or SYNC on the ring. code is the result */
+struct fs_ring_request{
+	enum fs_operation type;
+	FH_t file;
+	int count;
+	int offset;
+	int code;
+	char data[ FS_RING_DATA ];
+};
+
+/* shared by a client and the file server. request n is in slot
+ * n % FS_RING_SLOTS. the client fills slots and counts them in submitted,
+ * the server works through them in order and counts them in completed.
+ */
+struct fs_ring{
+	volatile int submitted;
+	volatile int completed;
+
+	/* only used by the client. results taken back, requests the server
+	 * was told about and the pid of the server
+	 */
+	int collected;
+	int announced;
+	int server;
+
+	struct fs_ring_request slots[ FS_RING_SLOTS ];
+};
+
+struct fs_message_ring{
+	enum fs_operation type;
+	int code;
+	struct fs_ring * ring;
+	int server;
+};
+
 int CreateFile( char * filename, FH_t dir );
 int CreateLink( char * link, FH_t dir, FH_t file );
 int CreateDir( char * dirname, FH_t dir );
@@ -156,4 +199,9 @@ char * readdir( FH_t dir, int * offset );
 int GetPath( char * path, int max_length, FH_t dir );
 int IsDirectory( FH_t id );
 
+struct fs_ring * FsRingOpen(void);
+int FsRingClose( struct fs_ring * ring );
+int FsRingSubmit( struct fs_ring * ring, enum fs_operation type, FH_t file, int count, int offset, char * data );
+int FsRingWait( struct fs_ring * ring, char * buffer );
+
 #endif
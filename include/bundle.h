@@ -0,0 +1,52 @@
+#ifndef _yalnix_bundle_h
+#define _yalnix_bundle_h
+
+#include <sys/types.h>
+#include "hardware.h"
+#include "load_info.h"
+#include "debug.h"
+
+/* file in the current directory the kernel looks for at boot */
+#define BUNDLE_FILE "yalnix.bundle"
+
+/* "YLNB" */
+#define BUNDLE_MAGIC 0x594c4e42
+
+#define BUNDLE_NAME_LENGTH 32
+
+/* A bundle is made by misc/mkbundle.c. It starts with a header followed by
+ * one entry per program. After the index come the text and initialized data
+ * pages of every program, exactly as loadProgram would read them from the
+ * executable, each starting on a page boundary of the bundle file.
+ *
+ * Both the kernel and mkbundle are built with -m32 so they agree on the
+ * layout of struct load_info.
+ */
+struct bundle_header{
+	int magic;
+	int count;
+};
+
+struct bundle_entry{
+	/* name given to Exec */
+	char name[ BUNDLE_NAME_LENGTH ];
+
+	/* the program file when the bundle was made. if it changed since then
+	 * the file is used instead of the bundle
+	 */
+	off_t size;
+	time_t modified;
+
+	/* what LoadInfo would return for the program */
+	struct load_info info;
+
+	/* offsets of info.t_npg text pages and info.id_npg data pages in the bundle */
+	off_t text;
+	off_t data;
+};
+
+void openBundle( const char * path );
+struct bundle_entry * findBundle( const char * name );
+YalnixError readBundle( struct bundle_entry * entry );
+
+#endif
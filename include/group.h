@@ -0,0 +1,22 @@
+#ifndef _yalnix_group_h
+#define _yalnix_group_h
+
+#define MAX_GROUPS 32
+
+/* processes in one group */
+#define GROUP_MAX_MEMBERS 16
+
+/* processes that get a copy of every GroupNotify message */
+struct group{
+	/* pids of the members, oldest first */
+	int members[ GROUP_MAX_MEMBERS ];
+	int count;
+};
+
+int createGroup();
+struct group * findGroup( int handle );
+int joinGroup( int handle, int pid );
+int leaveGroup( int handle, int pid );
+void leaveGroups( int pid );
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef _yalnix_image_h
+#define _yalnix_image_h
+
+#include <sys/types.h>
+#include "hardware.h"
+#include "load_info.h"
+#include "memory.h"
+#include "debug.h"
+
+/* most physical pages the image cache may hold */
+#define IMAGE_CACHE_PAGES 48
+
+/* text and initialized data of a program that was loaded before, kept in
+ * physical pages so another Exec of the same file doesn't have to read it again
+ */
+struct image{
+	/* host file the image came from */
+	char * name;
+
+	/* if any of these change the host file was replaced */
+	dev_t device;
+	ino_t inode;
+	off_t size;
+	time_t modified;
+
+	/* 1 if the image was read from the boot bundle. only size and modified
+	 * are known then, and the image stays good while the host file is missing
+	 */
+	int bundled;
+
+	/* parsed header of the program */
+	struct load_info info;
+
+	/* li.t_npg + li.id_npg pages, text first */
+	struct memory_page ** pages;
+	int npages;
+
+	/* set while loadProgram copies from the image so it is not evicted */
+	int busy;
+
+	/* least recently used list, most recent first */
+	struct image * next;
+	struct image * prev;
+};
+
+struct image * findImage( const char * name );
+void cacheImage( const char * name, int fd, struct load_info * info );
+void cacheBundledImage( const char * name, off_t size, time_t modified, struct load_info * info );
+YalnixError copyImage( struct image * image );
+int evictImage();
+int imageCachePages();
+
+#endif
@@ -12,13 +12,20 @@
  *  to: -1
  *  from: pid of process that is sending or -1
  *  receive: pid of process receiving
+ *  reply: 1 if it waits for the Reply to its Send, 0 if it is in Receive
  */
 struct ipc{
 	int to;
 	int from;
 	int receive;
+	int reply;
+	/* a sender waiting for any worker of this port to receive, otherwise 0 */
+	int port;
+	/* port a sender's request went through, 0 if it was sent to a pid */
+	int service;
 };
 
 int loadProgram( struct process * process, char *name, char *args[] );
+int terminalsTransmitting(void);
 
 #endif
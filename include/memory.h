@@ -4,6 +4,8 @@
 #define region0_memory (VMEM_0_LIMIT - VMEM_0_BASE)
 #define region0_pages (region0_memory / PAGESIZE)
 #define region1_pages (VMEM_1_SIZE / PAGESIZE)
+/* number of kernel stack pages */
+#define KERNEL_STACK_PAGES ((KERNEL_STACK_LIMIT - KERNEL_STACK_BASE) / PAGESIZE)
 
 #include "debug.h"
 
@@ -21,6 +23,17 @@ struct memory_page{
 	 */
 	int protection;
 
+	/* number of page tables mapping the frame. a frame in more than one
+	 * table is copy on write: nobody gets PROT_WRITE in the hardware table
+	 * until a writer takes its own copy with unsharePage.
+	 */
+	int refs;
+
+	/* 1 for a frame that MapShared put in several page tables on purpose.
+	 * everybody keeps writing to the same frame, it is never copy on write.
+	 */
+	int shared;
+
 	/* linked list pointer to next page when this page is stored in
 	 * a list of pages( free/used )
 	 */
@@ -36,10 +49,19 @@ void flushTLB0();
 void flushTLB1();
 struct memory_page * get_free_page();
 void add_free_page( struct memory_page * page );
+void release_page( struct memory_page * page );
+void sharePage( struct memory_page ** dest, int dest_index, struct memory_page ** src, int src_index );
+int unsharePage( struct memory_page ** table, int index );
+int unshareRange( struct memory_page ** table, void * p, int size );
 int to_page( unsigned long addr, int distance );
 void setupKernelStack( struct memory_page ** stack, int num_pages );
 void setupPageTable( struct memory_page ** table, int size );
 YalnixError copyBlockToPage( struct memory_page * page, char * block, int size );
+YalnixError copyPageToBlock( struct memory_page * page, char * block, int size );
+YalnixError clearPage( struct memory_page * page );
+YalnixError copyKernelStack( struct memory_page ** stack );
+int get_kernel_stack( struct memory_page ** stack );
+int add_kernel_stack( struct memory_page ** stack );
 int freePages( int i );
 
 void initializeVirtualMemory( const unsigned max_memory );
@@ -0,0 +1,39 @@
+#ifndef _yalnix_pipe_h
+#define _yalnix_pipe_h
+
+#include "sync.h"
+
+#define MAX_PIPES 32
+
+/* bytes a pipe holds before writers block */
+#define PIPE_SIZE 1024
+
+/* a bounded ring buffer between processes that were redirected to it */
+struct pipe{
+	char buffer[ PIPE_SIZE ];
+	/* oldest unread byte and number of unread bytes */
+	int start;
+	int count;
+
+	/* processes with their input or output redirected to the pipe */
+	int readers;
+	int writers;
+
+	/* pid of the process that made the pipe. a pipe nobody was ever
+	 * redirected to is freed when it exits
+	 */
+	int creator;
+
+	/* waiting for data and for room */
+	struct wait_queue read_waiters;
+	struct wait_queue write_waiters;
+};
+
+int createPipe( int creator );
+struct pipe * findPipe( int handle );
+void freePipe( int handle );
+void forgetPipeWaiter( struct process * process );
+int pipeRead( struct pipe * pipe, char * data, int length );
+int pipeWrite( struct pipe * pipe, char * data, int length );
+
+#endif
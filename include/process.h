@@ -4,9 +4,7 @@
 #include "hardware.h"
 #include "yalnix.h"
 #include "memory.h"
-
-/* number of kernel stack pages */
-#define KERNEL_STACK_PAGES ((KERNEL_STACK_LIMIT - KERNEL_STACK_BASE) / PAGESIZE)
+#include "syscalls.h"
 
 /* possible process states */
 #define PROCESS_RUNNABLE 1
@@ -15,6 +13,22 @@
 
 #define IPC_MAX_LENGTH 32
 
+/* threads get a fixed number of stack pages carved out of region 1 below
+ * the main stack. each thread stack has an unmapped guard page below it.
+ * once a process has threads its main stack is limited to
+ * THREAD_MAIN_STACK_PAGES pages.
+ */
+#define MAX_THREADS 8
+#define THREAD_STACK_PAGES 4
+#define THREAD_MAIN_STACK_PAGES 16
+
+/* MapShared puts its pages in a window of SHARED_PAGES pages right below
+ * the guard page of the lowest thread stack. while a process has some of
+ * them mapped its heap stays below the window, with a guard page, and its
+ * main stack above it.
+ */
+#define SHARED_PAGES 8
+
 /* used for the termination list each process has to keep track of
  * dead children.
  */
@@ -23,10 +37,27 @@ struct status_list{
 	int status;
 	/* pid of child */
 	int id;
+	/* resources used by the child and its reaped children */
+	struct usage usage;
 	/* linked list pointer */
 	struct status_list * next;
 };
 
+/* messages sent with SendAsync that were not received yet */
+#define MAILBOX_SIZE 16
+
+struct mail{
+	int from;
+	char message[ IPC_MAX_LENGTH ];
+};
+
+/* ring of mail, oldest first */
+struct mailbox{
+	struct mail messages[ MAILBOX_SIZE ];
+	int start;
+	int count;
+};
+
 struct process;
 
 /* linked list of processes */
@@ -71,14 +102,98 @@ struct process{
 	/* parent process */
 	struct process * parent;
 
-	/* array of alive children */
-	struct process ** children;
+	/* first child in the list of alive children */
+	struct process * first_child;
+
+	/* links in the parent's list of alive children */
+	struct process * next_sibling;
+	struct process * prev_sibling;
 
-	/* size of children array */
-	int max_children;
+	/* number of alive children */
+	int live_children;
 
-	/* linked list of status's for dead children */
+	/* linked list of status's for dead children, oldest first */
 	struct status_list terminated;
+	/* last node of terminated, for appending */
+	struct status_list * last_terminated;
+
+	/* pid of the child this process is waiting for, -1 for any child.
+	 * only meaningful while status is PROCESS_WAIT_FOR_DEAD_CHILD
+	 */
+	int wait_for;
+
+	/* process that owns the page table, heap and registered services.
+	 * a process that is not a thread is its own leader.
+	 */
+	struct process * leader;
+
+	/* threads of a leader, linked through next_thread */
+	struct process * first_thread;
+	struct process * next_thread;
+
+	/* number of alive threads, not counting the leader */
+	int threads;
+
+	/* bitmask of thread stack slots in use by the leader's threads */
+	int thread_slots;
+
+	/* stack slot of a thread, -1 for a leader */
+	int thread_slot;
+
+	/* thread waiting in ThreadJoin for this thread to exit */
+	struct process * joiner;
+
+	/* exit status's of threads that have not been joined */
+	struct status_list thread_exits;
+
+	/* exit code of a leader that is waiting for its threads to exit */
+	int exit_code;
+
+	/* 1 once some thread of the process called Exit. the process or
+	 * thread exits the next time it is in the kernel.
+	 */
+	int killed;
+
+	/* next process blocked on the same semaphore, lock, cvar or futex bucket */
+	struct process * next_waiter;
+
+	/* physical address this process sleeps on in FutexWait */
+	unsigned long futex_key;
+
+	/* lock to take back when woken up from CvarWait, -1 when not waiting */
+	int cvar_lock;
+
+	/* next process on the timer list, the ticks left before a blocking call
+	 * gives up and whether it did
+	 */
+	struct process * next_timer;
+	int timer;
+	int timed_out;
+
+	/* events a process blocked in Select waits for, see syscalls.h */
+	int select_events;
+
+	/* pages of the shared window that are mapped and whether Doorbell rang
+	 * since Select last reported it. only used on a leader.
+	 */
+	int shared_pages;
+	int doorbell;
+
+	/* pipes that TtyRead and TtyWrite go to instead of a terminal, -1 for
+	 * none. only used on a leader, threads share them.
+	 */
+	int pipe_in;
+	int pipe_out;
+
+	/* resources used by this process and its reaped children */
+	struct usage usage;
+	struct usage child_usage;
+
+	/* ipc counters, only used on a leader */
+	struct ipc_stats ipc_stats;
+
+	/* time the current user, kernel or blocked period started */
+	unsigned long long usage_mark;
 
 	/* pages in region 1 that this process owns */
 	struct memory_page ** page_table;
@@ -86,6 +201,9 @@ struct process{
 	/* messages sent to this process wait here */
 	caddr_t inbox[ IPC_MAX_LENGTH ];
 
+	/* asynchronous messages of a leader, made on the first SendAsync to it */
+	struct mailbox * mailbox;
+
 	/* registers for user space */
 	UserContext user_context;
 
@@ -95,6 +213,17 @@ struct process{
 
 struct process * createProcess(void);
 void freeProcess( struct process * process );
-int addChildToProcess( struct process * parent, struct process * child );
+void addChildToProcess( struct process * parent, struct process * child );
+void removeChildFromProcess( struct process * parent, struct process * child );
+
+struct process * createThread( struct process * leader );
+void removeThreadFromProcess( struct process * leader, struct process * thread );
+int threadStackTop( int slot );
+int mainStackFloor( struct process * leader );
+int heapCeiling( struct process * leader );
+int sharedWindowBase(void);
+
+int putMail( struct process * leader, int from, char * message );
+int takeMail( struct process * leader, int from, char * buffer );
 
 #endif
@@ -17,8 +17,11 @@ void addToRunList( struct process_list * list );
 void addToDiskList( struct process_list * list );
 
 int isIdle( struct process_list * list );
+int onDiskList( struct process_list * list );
 
 struct process_list * findIpc( int to, int from, int receive );
+struct process_list * findWaitingReceiver( int receive, int from );
+struct process_list * findPortSender( int port );
 struct process * findProcess( int id );
 struct process_list * findIOProcess( int attribute );
 
@@ -0,0 +1,48 @@
+#ifndef _yalnix_sync_h
+#define _yalnix_sync_h
+
+#include "process.h"
+
+/* kinds of synchronization objects */
+#define SYNC_SEMAPHORE 1
+#define SYNC_LOCK 2
+#define SYNC_CVAR 3
+
+/* processes blocked on something, oldest first. they are linked through
+ * process->next_waiter so queueing never allocates.
+ */
+struct wait_queue{
+	struct process * first;
+	struct process * last;
+};
+
+/* a semaphore, lock or condition variable. all of them share one table
+ * of handles so Reclaim works on any of them.
+ */
+struct sync_object{
+	int type;
+
+	/* count of a semaphore */
+	int value;
+
+	/* process that holds a lock, 0 if it is free */
+	struct process * holder;
+
+	/* processes blocked on the object */
+	struct wait_queue waiters;
+};
+
+int createSync( int type, int value );
+struct sync_object * findSync( int handle, int type );
+int reclaimSync( int handle );
+struct sync_object * findHeldLock( struct process * process );
+
+void futexEnqueue( unsigned long key, struct process * process );
+struct process * futexDequeue( unsigned long key );
+
+void enqueueWaiter( struct wait_queue * queue, struct process * process );
+struct process * dequeueWaiter( struct wait_queue * queue );
+void removeWaiter( struct wait_queue * queue, struct process * process );
+void forgetWaiter( struct process * process );
+
+#endif
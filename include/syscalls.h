@@ -0,0 +1,281 @@
+#ifndef _yalnix_syscalls_h
+#define _yalnix_syscalls_h
+
+/* System calls that are not part of the standard yalnix interface.
+ *
+ * The user library only has stubs for the calls listed in yalnix.h, so
+ * every extra call goes through Custom0. The first argument selects the
+ * call and the other three are passed along as its arguments. The kernel
+ * dispatches on the selector in handleCustom().
+ */
+
+#define SYSCALL_SPAWN 1
+#define SYSCALL_THREAD_CREATE 2
+#define SYSCALL_THREAD_JOIN 3
+#define SYSCALL_WAIT_PID 4
+#define SYSCALL_GET_RUSAGE 5
+#define SYSCALL_FUTEX_WAIT 6
+#define SYSCALL_FUTEX_WAKE 7
+#define SYSCALL_PIPE_CREATE 8
+#define SYSCALL_REDIRECT 9
+#define SYSCALL_SEND_ASYNC 10
+#define SYSCALL_REPLY_AND_RECEIVE 11
+#define SYSCALL_COPY_FROM_V 12
+#define SYSCALL_COPY_TO_V 13
+#define SYSCALL_RECEIVE_TIMEOUT 14
+#define SYSCALL_SELECT 15
+#define SYSCALL_MAP_SHARED 16
+#define SYSCALL_UNMAP_SHARED 17
+#define SYSCALL_DOORBELL 18
+#define SYSCALL_GROUP_CREATE 19
+#define SYSCALL_GROUP_JOIN 20
+#define SYSCALL_GROUP_LEAVE 21
+#define SYSCALL_GROUP_NOTIFY 22
+#define SYSCALL_IPC_STATS 23
+#define SYSCALL_THREAD_EXIT 24
+
+/* Spawn( char * path, char ** argv )
+ * Create a child running the program in path without copying the caller.
+ * Returns the pid of the child or ERROR.
+ */
+#define Spawn( path, argv ) Custom0( SYSCALL_SPAWN, (int)(path), (int)(argv), 0 )
+
+/* flags for WaitPid */
+#define WAIT_NOHANG 1
+
+/* WaitPid( int pid, int * status, int flags )
+ * Reap the child pid, or any child if pid is -1. status may be 0. Blocks
+ * until the child exits unless WAIT_NOHANG is given, in which case 0 is
+ * returned if it is still alive. Returns the pid of the reaped child or
+ * ERROR if there is no such child.
+ */
+#define WaitPid( pid, status, flags ) Custom0( SYSCALL_WAIT_PID, (int)(pid), (int)(status), (int)(flags) )
+
+/* resource usage filled in by GetRusage. times are in microseconds */
+struct usage{
+	/* running user code */
+	unsigned long long user_time;
+	/* running in the kernel on behalf of the process */
+	unsigned long long kernel_time;
+	/* sleeping in a syscall, i.e. waiting for i/o, ipc, children or Delay */
+	unsigned long long blocked_time;
+	/* memory traps, including stack growth */
+	unsigned int faults;
+	unsigned int syscalls;
+	/* ipc messages sent and received */
+	unsigned int messages;
+	/* disk sectors read and written */
+	unsigned int sectors;
+};
+
+/* who for GetRusage */
+#define USAGE_SELF 0
+#define USAGE_CHILDREN 1
+
+/* GetRusage( int who, struct usage * usage )
+ * Fill usage with the resources used by the caller or, with USAGE_CHILDREN,
+ * by all of its children that have been reaped by Wait. Returns 0 or ERROR.
+ */
+#define GetRusage( who, usage ) Custom0( SYSCALL_GET_RUSAGE, (int)(who), (int)(usage), 0 )
+
+/* buckets of the ipc latency histograms. bucket 0 counts waits under a
+ * microsecond, bucket i waits from 2^(i-1) up to 2^i microseconds and the
+ * last bucket everything longer
+ */
+#define IPC_HISTOGRAM_BUCKETS 24
+
+struct ipc_stats{
+	/* Send calls that got a reply, messages received and replies sent */
+	unsigned int sends;
+	unsigned int receives;
+	unsigned int replies;
+	/* bytes moved with CopyFrom, CopyTo, CopyFromV and CopyToV */
+	unsigned long long bytes_copied;
+	/* microseconds senders waited for a receiver and then for the reply */
+	unsigned long long receiver_wait;
+	unsigned long long reply_wait;
+	/* the same waits, one Send at a time */
+	unsigned int receiver_histogram[ IPC_HISTOGRAM_BUCKETS ];
+	unsigned int reply_histogram[ IPC_HISTOGRAM_BUCKETS ];
+};
+
+/* who for IpcStats */
+#define IPC_STATS_PROCESS 0
+#define IPC_STATS_PORT 1
+
+/* IpcStats( int who, int id, struct ipc_stats * stats )
+ * Fill stats for process id, 0 for the caller, or for port id. A process
+ * counts its own Sends, what it received and replied and what it copied
+ * as a server. A port counts the Sends to it and what its workers copied
+ * for those requests. Returns 0 or ERROR.
+ */
+#define IpcStats( who, id, stats ) Custom0( SYSCALL_IPC_STATS, (int)(who), (int)(id), (int)(stats) )
+
+/* ThreadCreate( void (*func)( int ), int arg )
+ * Start a thread that runs func( arg ) in the caller's address space. Threads
+ * share the heap and registered services but each has its own small stack,
+ * so deep recursion in a thread is fatal. func must not return, it has to
+ * end with ThreadExit. Returns the thread id or ERROR.
+ */
+#define ThreadCreate( func, arg ) Custom0( SYSCALL_THREAD_CREATE, (int)(func), (int)(arg), 0 )
+
+/* ThreadJoin( int tid, int * status )
+ * Wait for thread tid of the same process to exit. status may be 0.
+ * Returns 0 or ERROR.
+ */
+#define ThreadJoin( tid, status ) Custom0( SYSCALL_THREAD_JOIN, (int)(tid), (int)(status), 0 )
+
+/* ThreadExit( int status )
+ * End only the calling thread. When the main thread does this the process
+ * goes away once all other threads have exited too. Exit from any thread
+ * ends the whole process.
+ */
+#define ThreadExit( status ) Custom0( SYSCALL_THREAD_EXIT, (int)(status), 0, 0 )
+
+/* FutexWait( int * addr, int value )
+ * Sleep until FutexWake is called on addr, but only if *addr still equals
+ * value. Processes that share the page holding addr, such as threads,
+ * wait on the same futex. Returns 0 when woken up, 1 right away if *addr
+ * did not equal value, or ERROR if addr is not a writable aligned int.
+ */
+#define FutexWait( addr, value ) Custom0( SYSCALL_FUTEX_WAIT, (int)(addr), (int)(value), 0 )
+
+/* FutexWake( int * addr, int count )
+ * Wake up to count processes sleeping in FutexWait on addr, oldest first.
+ * Returns the number woken up or ERROR.
+ */
+#define FutexWake( addr, count ) Custom0( SYSCALL_FUTEX_WAKE, (int)(addr), (int)(count), 0 )
+
+/* PipeCreate( int * pipe )
+ * Make a pipe and store its id in pipe. The pipe is only used once some
+ * process is redirected to it and it goes away when nobody is redirected
+ * to it anymore, or when the caller exits if nobody ever was. Returns 0
+ * or ERROR.
+ */
+#define PipeCreate( pipe ) Custom0( SYSCALL_PIPE_CREATE, (int)(pipe), 0, 0 )
+
+/* Redirect( int in, int out )
+ * Make TtyRead read from pipe in and TtyWrite write to pipe out, whatever
+ * terminal they are given. -1 goes back to the terminal. Children made by
+ * Fork or Spawn start with the same redirection. TtyRead from a pipe
+ * returns whatever is buffered, or 0 once it is empty and nobody writes to
+ * it anymore. TtyWrite to a pipe blocks until all of it is buffered and
+ * fails once nobody reads from the pipe. Returns 0 or ERROR.
+ */
+#define Redirect( in, out ) Custom0( SYSCALL_REDIRECT, (int)(in), (int)(out), 0 )
+
+/* SendAsync( void * message, int to )
+ * Send a message like Send but return right away without a reply. If the
+ * receiver is not in Receive the message waits in its mailbox, which
+ * holds 16 messages, and Receive takes mailbox messages before blocking.
+ * to may be a negative port like Send. Returns 0, or ERROR if there is no
+ * such process or its mailbox is full.
+ */
+#define SendAsync( message, to ) Custom0( SYSCALL_SEND_ASYNC, (int)(message), (int)(to), 0 )
+
+/* GroupCreate( int * group )
+ * Make a notification group with the caller as its only member and store
+ * its id in group. A group holds up to 16 processes and goes away when the
+ * last one leaves or exits. Returns 0 or ERROR.
+ */
+#define GroupCreate( group ) Custom0( SYSCALL_GROUP_CREATE, (int)(group), 0, 0 )
+
+/* GroupJoin( int group ) and GroupLeave( int group )
+ * Add the caller to a group or take it out. Children made by Fork are not
+ * members. Return 0 or ERROR.
+ */
+#define GroupJoin( group ) Custom0( SYSCALL_GROUP_JOIN, (int)(group), 0, 0 )
+#define GroupLeave( group ) Custom0( SYSCALL_GROUP_LEAVE, (int)(group), 0, 0 )
+
+/* GroupNotify( void * message, int group )
+ * SendAsync message to every member of group except the caller in one
+ * call. Nobody is waited for and a member whose mailbox is full misses the
+ * message. The caller does not have to be a member. Returns the number of
+ * members that got it or ERROR.
+ */
+#define GroupNotify( message, group ) Custom0( SYSCALL_GROUP_NOTIFY, (int)(message), (int)(group), 0 )
+
+/* ReplyAndReceive( void * message, int pid )
+ * Reply to pid with message, then Receive the next message into message.
+ * One trap instead of two for a server loop, and the client that got the
+ * reply runs as soon as the server waits. Returns the sender of the new
+ * message or ERROR. If the reply fails nothing is received and ERROR is
+ * returned right away.
+ */
+#define ReplyAndReceive( message, pid ) Custom0( SYSCALL_REPLY_AND_RECEIVE, (int)(message), (int)(pid), 0 )
+
+/* one piece of a vectored copy. local is in the caller, remote in the
+ * other process.
+ */
+struct copy_segment{
+	void * local;
+	void * remote;
+	int length;
+};
+
+/* most segments in one CopyFromV or CopyToV */
+#define COPY_MAX_SEGMENTS 16
+
+/* CopyFromV( int pid, struct copy_segment * segments, int count )
+ * Like CopyFrom for each of the count segments, remote to local, in one
+ * trap. pid has to be waiting for a reply from the caller. Every segment
+ * is checked before any is copied, so on ERROR nothing was copied unless
+ * the kernel ran out of memory. Returns 0 or ERROR.
+ */
+#define CopyFromV( pid, segments, count ) Custom0( SYSCALL_COPY_FROM_V, (int)(pid), (int)(segments), (int)(count) )
+
+/* CopyToV( int pid, struct copy_segment * segments, int count )
+ * Like CopyTo for each segment, local to remote. Returns 0 or ERROR.
+ */
+#define CopyToV( pid, segments, count ) Custom0( SYSCALL_COPY_TO_V, (int)(pid), (int)(segments), (int)(count) )
+
+/* ReceiveTimeout( void * message, int ticks )
+ * Receive, but give up after ticks clock ticks. With 0 ticks it only takes
+ * a message that is already there or a sender that is already waiting.
+ * Returns the sender's pid, 0 if nothing arrived in time, or ERROR.
+ */
+#define ReceiveTimeout( message, ticks ) Custom0( SYSCALL_RECEIVE_TIMEOUT, (int)(message), (int)(ticks), 0 )
+
+/* ReceivePoll( void * message )
+ * Receive without blocking. Returns like ReceiveTimeout.
+ */
+#define ReceivePoll( message ) ReceiveTimeout( message, 0 )
+
+/* events for Select. terminal n is SELECT_TTY( n ) */
+#define SELECT_TTY( n ) (1 << (n))
+#define SELECT_MESSAGE 0x100
+#define SELECT_CHILD 0x200
+#define SELECT_DOORBELL 0x400
+#define SELECT_ALL ((SELECT_TTY( NUM_TERMINALS ) - 1) | SELECT_MESSAGE | SELECT_CHILD | SELECT_DOORBELL)
+
+/* Select( int ttys, int flags, int ticks )
+ * Wait until a terminal in the ttys mask has input, a message can be
+ * received with SELECT_MESSAGE in flags, a child has exited with
+ * SELECT_CHILD, or somebody called Doorbell with SELECT_DOORBELL, but at
+ * most ticks clock ticks. -1 waits forever and 0 only checks. Only the
+ * doorbell is consumed. Returns the ready events, 0 if none got ready in
+ * time, or ERROR.
+ */
+#define Select( ttys, flags, ticks ) Custom0( SYSCALL_SELECT, (int)(ttys), (int)(flags), (int)(ticks) )
+
+/* MapShared( int pid, int pages )
+ * Map pages new zeroed pages, at most SHARED_PAGES, into both the caller
+ * and pid, which has to be waiting for a reply from the caller. The pages
+ * are at the same address in both and writes by either are seen by the
+ * other, so FutexWait and FutexWake work across them. Both heaps have to
+ * be below the shared window. Returns the address or ERROR.
+ */
+#define MapShared( pid, pages ) Custom0( SYSCALL_MAP_SHARED, (int)(pid), (int)(pages), 0 )
+
+/* UnmapShared( void * addr, int pages )
+ * Unmap shared pages from the caller. Returns 0 or ERROR.
+ */
+#define UnmapShared( addr, pages ) Custom0( SYSCALL_UNMAP_SHARED, (int)(addr), (int)(pages), 0 )
+
+/* Doorbell( int pid )
+ * Wake pid up from a Select for SELECT_DOORBELL without a message. Rings
+ * that come before pid looks are merged into one. Returns 0 or ERROR.
+ */
+#define Doorbell( pid ) Custom0( SYSCALL_DOORBELL, (int)(pid), 0, 0 )
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _yalnix_ulock_h
+#define _yalnix_ulock_h
+
+/* A lock that lives in user memory. Taking or releasing it when nobody
+ * else wants it is a single atomic instruction, the kernel is only entered
+ * through FutexWait and FutexWake when there is contention. It only works
+ * between processes that share the page holding the lock, i.e. threads.
+ *
+ * The lock word is 0 when free, 1 when held and 2 when held and somebody
+ * may be sleeping on it. Initialize it to ULOCK_INITIALIZER.
+ */
+
+#include "yalnix.h"
+#include "syscalls.h"
+
+#define ULOCK_INITIALIZER 0
+
+/* atomically set *word to value if it was old. returns what *word was */
+static inline int ulockCompareExchange( volatile int * word, int old, int value ){
+	int previous;
+	__asm__ __volatile__( "lock; cmpxchgl %2, %1"
+			: "=a" ( previous ), "+m" ( *word )
+			: "r" ( value ), "0" ( old )
+			: "memory" );
+	return previous;
+}
+
+/* atomically store value in *word and return what it was */
+static inline int ulockExchange( volatile int * word, int value ){
+	__asm__ __volatile__( "xchgl %0, %1"
+			: "+r" ( value ), "+m" ( *word )
+			:
+			: "memory" );
+	return value;
+}
+
+static inline void ulockAcquire( volatile int * lock ){
+	int state = ulockCompareExchange( lock, 0, 1 );
+	if ( state == 0 ){
+		return;
+	}
+	/* mark the lock contended before sleeping so the holder wakes us */
+	if ( state != 2 ){
+		state = ulockExchange( lock, 2 );
+	}
+	while ( state != 0 ){
+		FutexWait( lock, 2 );
+		state = ulockExchange( lock, 2 );
+	}
+}
+
+static inline void ulockRelease( volatile int * lock ){
+	if ( ulockExchange( lock, 0 ) == 2 ){
+		FutexWake( lock, 1 );
+	}
+}
+
+#endif
@@ -0,0 +1,176 @@
+/* mkbundle: pack yalnix programs into one file the kernel reads at boot
+ *
+ * $ mkbundle yalnix.bundle init fileserver console bash shell
+ *
+ * Each program is stored under the name it is given on the command line,
+ * which is the name that has to be passed to Exec. The load_info of every
+ * program is worked out here from its ELF program headers so the kernel
+ * never has to parse them. See include/bundle.h for the layout.
+ *
+ * Build it with -m32 like the kernel.
+ */
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bundle.h"
+
+static char page[ PAGESIZE ];
+
+/* fill in info the same way LoadInfo does. returns 0 or -1 */
+static int loadInfo( int fd, struct load_info * info ){
+	Elf32_Ehdr header;
+	Elf32_Phdr segment;
+	int text = 0;
+	int data = 0;
+	int i;
+
+	if ( pread( fd, &header, sizeof( header ), 0 ) != sizeof( header ) ||
+	     memcmp( header.e_ident, ELFMAG, SELFMAG ) != 0 ||
+	     header.e_ident[ EI_CLASS ] != ELFCLASS32 ||
+	     header.e_type != ET_EXEC ){
+		return -1;
+	}
+
+	bzero( info, sizeof( struct load_info ) );
+	info->entry = header.e_entry;
+
+	for ( i = 0; i < header.e_phnum; i++ ){
+		off_t where = header.e_phoff + i * header.e_phentsize;
+		if ( pread( fd, &segment, sizeof( segment ), where ) != sizeof( segment ) ){
+			return -1;
+		}
+		if ( segment.p_type != PT_LOAD ){
+			continue;
+		}
+		if ( segment.p_flags & PF_W ){
+			info->id_faddr = DOWN_TO_PAGE( segment.p_offset );
+			info->id_vaddr = DOWN_TO_PAGE( segment.p_vaddr );
+			info->id_end = segment.p_vaddr + segment.p_filesz;
+			info->id_npg = (UP_TO_PAGE( info->id_end ) - info->id_vaddr) >> PAGESHIFT;
+			info->ud_vaddr = UP_TO_PAGE( info->id_end );
+			info->ud_end = segment.p_vaddr + segment.p_memsz;
+			info->ud_npg = (UP_TO_PAGE( info->ud_end ) - info->ud_vaddr) >> PAGESHIFT;
+			data += 1;
+		} else {
+			info->t_faddr = DOWN_TO_PAGE( segment.p_offset );
+			info->t_vaddr = DOWN_TO_PAGE( segment.p_vaddr );
+			info->t_end = segment.p_vaddr + segment.p_memsz;
+			info->t_npg = (UP_TO_PAGE( info->t_end ) - info->t_vaddr) >> PAGESHIFT;
+			text += 1;
+		}
+	}
+
+	/* yalnix programs have exactly one text and one data segment */
+	if ( text != 1 || data != 1 ){
+		return -1;
+	}
+	return 0;
+}
+
+/* copy pages from the program at offset to the end of the bundle.
+ * the last page of a file may be short, it is padded with zeros.
+ */
+static int copyPages( int from, off_t offset, int pages, FILE * out ){
+	int i;
+	for ( i = 0; i < pages; i++ ){
+		int got = pread( from, page, PAGESIZE, offset + i * PAGESIZE );
+		if ( got < 0 ){
+			return -1;
+		}
+		bzero( page + got, PAGESIZE - got );
+		if ( fwrite( page, PAGESIZE, 1, out ) != 1 ){
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main( int argc, char ** argv ){
+	struct bundle_header header;
+	struct bundle_entry * entries;
+	int * fds;
+	off_t offset;
+	FILE * out;
+	int i;
+
+	if ( argc < 3 ){
+		fprintf( stderr, "Usage: %s bundle program ...\n", argv[ 0 ] );
+		return 1;
+	}
+
+	header.magic = BUNDLE_MAGIC;
+	header.count = argc - 2;
+	entries = (struct bundle_entry *) calloc( header.count, sizeof( struct bundle_entry ) );
+	fds = (int *) malloc( sizeof( int ) * header.count );
+	if ( ! entries || ! fds ){
+		fprintf( stderr, "Out of memory\n" );
+		return 1;
+	}
+
+	/* program pages start on the first page after the index */
+	offset = UP_TO_PAGE( sizeof( header ) + sizeof( struct bundle_entry ) * header.count );
+
+	for ( i = 0; i < header.count; i++ ){
+		char * name = argv[ i + 2 ];
+		struct bundle_entry * entry = &entries[ i ];
+		struct stat status;
+		if ( strlen( name ) >= BUNDLE_NAME_LENGTH ){
+			fprintf( stderr, "Name too long: %s\n", name );
+			return 1;
+		}
+		fds[ i ] = open( name, O_RDONLY );
+		if ( fds[ i ] < 0 ){
+			perror( name );
+			return 1;
+		}
+		if ( loadInfo( fds[ i ], &entry->info ) != 0 ){
+			fprintf( stderr, "%s is not in Yalnix format\n", name );
+			return 1;
+		}
+		if ( fstat( fds[ i ], &status ) != 0 ){
+			perror( name );
+			return 1;
+		}
+		strcpy( entry->name, name );
+		entry->size = status.st_size;
+		entry->modified = status.st_mtime;
+		entry->text = offset;
+		offset += entry->info.t_npg << PAGESHIFT;
+		entry->data = offset;
+		offset += entry->info.id_npg << PAGESHIFT;
+	}
+
+	out = fopen( argv[ 1 ], "wb" );
+	if ( ! out ){
+		perror( argv[ 1 ] );
+		return 1;
+	}
+
+	if ( fwrite( &header, sizeof( header ), 1, out ) != 1 ||
+	     fwrite( entries, sizeof( struct bundle_entry ), header.count, out ) != header.count ||
+	     fseek( out, entries[ 0 ].text, SEEK_SET ) != 0 ){
+		perror( argv[ 1 ] );
+		return 1;
+	}
+
+	for ( i = 0; i < header.count; i++ ){
+		struct bundle_entry * entry = &entries[ i ];
+		if ( copyPages( fds[ i ], entry->info.t_faddr, entry->info.t_npg, out ) != 0 ||
+		     copyPages( fds[ i ], entry->info.id_faddr, entry->info.id_npg, out ) != 0 ){
+			perror( argv[ i + 2 ] );
+			return 1;
+		}
+		close( fds[ i ] );
+		printf( "%s: %lu text %lu data pages\n", entry->name, entry->info.t_npg, entry->info.id_npg );
+	}
+
+	fclose( out );
+	free( entries );
+	free( fds );
+	return 0;
+}
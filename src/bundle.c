@@ -0,0 +1,91 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bundle.h"
+
+/* the bundle stays open so every load is a seek and a read */
+static int bundle_fd = -1;
+
+static struct bundle_entry * entries = 0;
+static int entry_count = 0;
+
+/* read the index of the bundle at path. if there is no usable bundle
+ * programs are simply read from their own files.
+ */
+void openBundle( const char * path ){
+	struct bundle_header header;
+	int size;
+	int fd = open( path, O_RDONLY );
+	if ( fd < 0 ){
+		TracePrintf( 3, "No program bundle %s\n", path );
+		return;
+	}
+
+	if ( read( fd, &header, sizeof( header ) ) != sizeof( header ) ||
+	     header.magic != BUNDLE_MAGIC || header.count <= 0 ){
+		TracePrintf( 0, "%s is not a program bundle\n", path );
+		close( fd );
+		return;
+	}
+
+	size = sizeof( struct bundle_entry ) * header.count;
+	entries = (struct bundle_entry *) malloc( size );
+	if ( ! entries ){
+		close( fd );
+		return;
+	}
+
+	if ( read( fd, entries, size ) != size ){
+		TracePrintf( 0, "Program bundle %s is truncated\n", path );
+		free( entries );
+		entries = 0;
+		close( fd );
+		return;
+	}
+
+	bundle_fd = fd;
+	entry_count = header.count;
+	TracePrintf( 1, "Loaded bundle %s with %d programs\n", path, entry_count );
+}
+
+/* return the bundled program named name or 0. a program that was rebuilt
+ * after the bundle was made is not served from the bundle.
+ */
+struct bundle_entry * findBundle( const char * name ){
+	struct stat info;
+	int i;
+	for ( i = 0; i < entry_count; i++ ){
+		struct bundle_entry * entry = &entries[ i ];
+		if ( strncmp( entry->name, name, BUNDLE_NAME_LENGTH ) == 0 ){
+			if ( stat( name, &info ) == 0 &&
+			     (info.st_size != entry->size || info.st_mtime != entry->modified) ){
+				TracePrintf( 3, "Bundled program %s is out of date\n", name );
+				return 0;
+			}
+			return entry;
+		}
+	}
+	return 0;
+}
+
+static YalnixError readSegment( off_t offset, u_long address, int pages ){
+	int size = pages << PAGESHIFT;
+	if ( lseek( bundle_fd, offset, SEEK_SET ) != offset ||
+	     read( bundle_fd, (void *) address, size ) != size ){
+		return YALNIX_INVALID_PROGRAM;
+	}
+	return YALNIX_NO_ERROR;
+}
+
+/* read the text and initialized data of a bundled program into region 1,
+ * which must already be mapped writable.
+ */
+YalnixError readBundle( struct bundle_entry * entry ){
+	YalnixError error = readSegment( entry->text, entry->info.t_vaddr, entry->info.t_npg );
+	if ( error != YALNIX_NO_ERROR ){
+		return error;
+	}
+	return readSegment( entry->data, entry->info.id_vaddr, entry->info.id_npg );
+}
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include "yalnix.h"
+#include "group.h"
+#include "debug.h"
+
+/* a handle is an index into this table */
+static struct group * groups[ MAX_GROUPS ];
+
+/* make an empty group and return its handle, or ERROR if there are too
+ * many groups or no memory
+ */
+int createGroup(){
+	struct group * group;
+	int handle;
+	for ( handle = 0; handle < MAX_GROUPS && groups[ handle ] != 0; handle++ ){
+	}
+	if ( handle == MAX_GROUPS ){
+		return ERROR;
+	}
+
+	group = (struct group *) malloc( sizeof( struct group ) );
+	if ( ! group ){
+		return ERROR;
+	}
+	group->count = 0;
+
+	groups[ handle ] = group;
+	TracePrintf( 5, "Created group %d\n", handle );
+	return handle;
+}
+
+struct group * findGroup( int handle ){
+	if ( handle < 0 || handle >= MAX_GROUPS ){
+		return 0;
+	}
+	return groups[ handle ];
+}
+
+/* add pid to a group. joining twice is fine. returns 0 or ERROR if there
+ * is no such group or it is full
+ */
+int joinGroup( int handle, int pid ){
+	struct group * group = findGroup( handle );
+	int i;
+	if ( ! group ){
+		return ERROR;
+	}
+	for ( i = 0; i < group->count; i++ ){
+		if ( group->members[ i ] == pid ){
+			return 0;
+		}
+	}
+	if ( group->count == GROUP_MAX_MEMBERS ){
+		return ERROR;
+	}
+	group->members[ group->count ] = pid;
+	group->count += 1;
+	return 0;
+}
+
+/* take pid out of a group. the group goes away with its last member.
+ * returns 0 or ERROR if pid was not in it
+ */
+int leaveGroup( int handle, int pid ){
+	struct group * group = findGroup( handle );
+	int i;
+	if ( ! group ){
+		return ERROR;
+	}
+	for ( i = 0; i < group->count && group->members[ i ] != pid; i++ ){
+	}
+	if ( i == group->count ){
+		return ERROR;
+	}
+	for ( ; i < group->count - 1; i++ ){
+		group->members[ i ] = group->members[ i + 1 ];
+	}
+	group->count -= 1;
+
+	if ( group->count == 0 ){
+		TracePrintf( 5, "Free group %d\n", handle );
+		free( group );
+		groups[ handle ] = 0;
+	}
+	return 0;
+}
+
+/* take pid out of every group it is in, for when it exits */
+void leaveGroups( int pid ){
+	int handle;
+	for ( handle = 0; handle < MAX_GROUPS; handle++ ){
+		if ( groups[ handle ] != 0 ){
+			leaveGroup( handle, pid );
+		}
+	}
+}
@@ -0,0 +1,240 @@
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image.h"
+#include "debug.h"
+#include "memory.h"
+
+/* cached images, most recently used first */
+static struct image images = { .next = 0, .prev = 0 };
+
+/* physical pages held by all cached images */
+static int cached_pages = 0;
+
+static void unlinkImage( struct image * image ){
+	image->prev->next = image->next;
+	if ( image->next ){
+		image->next->prev = image->prev;
+	}
+	image->next = 0;
+	image->prev = 0;
+}
+
+static void pushImage( struct image * image ){
+	image->next = images.next;
+	image->prev = &images;
+	if ( image->next ){
+		image->next->prev = image;
+	}
+	images.next = image;
+}
+
+/* give the pages of an image back to the free list */
+static void freeImage( struct image * image ){
+	int i;
+	for ( i = 0; i < image->npages; i++ ){
+		if ( image->pages[ i ] != 0 ){
+			add_free_page( image->pages[ i ] );
+		}
+	}
+	free( image->pages );
+	free( image->name );
+	free( image );
+}
+
+/* remove an image from the cache and free it */
+static void dropImage( struct image * image ){
+	unlinkImage( image );
+	cached_pages -= image->npages;
+	freeImage( image );
+}
+
+/* address in region 1 that page i of an image belongs at */
+static char * imageAddress( struct load_info * info, int i ){
+	if ( i < info->t_npg ){
+		return (char *) info->t_vaddr + (i << PAGESHIFT);
+	}
+	return (char *) info->id_vaddr + ((i - info->t_npg) << PAGESHIFT);
+}
+
+/* throw away the least recently used image that is not in use.
+ * returns 1 if an image was evicted, 0 if there was nothing to evict.
+ */
+int evictImage(){
+	struct image * image;
+	struct image * last = 0;
+	for ( image = images.next; image != 0; image = image->next ){
+		if ( ! image->busy ){
+			last = image;
+		}
+	}
+	if ( last == 0 ){
+		return 0;
+	}
+	TracePrintf( 5, "Evict image %s\n", last->name );
+	dropImage( last );
+	return 1;
+}
+
+/* number of physical pages the cache could give back right now */
+int imageCachePages(){
+	struct image * image;
+	int count = 0;
+	for ( image = images.next; image != 0; image = image->next ){
+		if ( ! image->busy ){
+			count += image->npages;
+		}
+	}
+	return count;
+}
+
+/* 1 if the image still matches the host file, whose stat is in info if
+ * exists is set. a bundled image is checked the way findBundle checks it.
+ */
+static int imageCurrent( struct image * image, int exists, struct stat * info ){
+	if ( image->bundled ){
+		return ! exists || (image->size == info->st_size && image->modified == info->st_mtime);
+	}
+	return exists &&
+	       image->device == info->st_dev &&
+	       image->inode == info->st_ino &&
+	       image->size == info->st_size &&
+	       image->modified == info->st_mtime;
+}
+
+/* return the cached image of the host file 'name' or 0 if it isn't cached.
+ * an image of a file that changed since it was cached is thrown away.
+ */
+struct image * findImage( const char * name ){
+	struct stat info;
+	struct image * image;
+	int exists = stat( name, &info ) == 0;
+
+	for ( image = images.next; image != 0; image = image->next ){
+		if ( strcmp( image->name, name ) == 0 ){
+			if ( imageCurrent( image, exists, &info ) ){
+				/* move to the front of the lru list */
+				unlinkImage( image );
+				pushImage( image );
+				TracePrintf( 5, "Image cache hit for %s\n", name );
+				return image;
+			}
+			TracePrintf( 5, "Image %s changed on disk\n", name );
+			if ( ! image->busy ){
+				dropImage( image );
+			}
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+/* copy the text and initialized data of the program that was just read
+ * into region 1 into a new image. returns 0 if the program is too big for
+ * the cache or there is no memory for it. the caller fills in where the
+ * image came from and calls addImage.
+ */
+static struct image * makeImage( const char * name, struct load_info * info ){
+	struct image * image;
+	int npages = info->t_npg + info->id_npg;
+	int i;
+
+	if ( npages > IMAGE_CACHE_PAGES ){
+		return 0;
+	}
+
+	while ( cached_pages + npages > IMAGE_CACHE_PAGES && evictImage() ){
+		/**/
+	}
+	if ( cached_pages + npages > IMAGE_CACHE_PAGES ){
+		return 0;
+	}
+
+	image = (struct image *) malloc( sizeof( struct image ) );
+	if ( ! image ){
+		return 0;
+	}
+	image->name = (char *) malloc( strlen( name ) + 1 );
+	image->pages = (struct memory_page **) malloc( sizeof( struct memory_page * ) * npages );
+	image->npages = npages;
+	if ( ! image->name || ! image->pages ){
+		free( image->name );
+		free( image->pages );
+		free( image );
+		return 0;
+	}
+	strcpy( image->name, name );
+	bzero( image->pages, sizeof( struct memory_page * ) * npages );
+
+	for ( i = 0; i < npages; i++ ){
+		image->pages[ i ] = get_free_page();
+		if ( ! image->pages[ i ] ||
+		     copyBlockToPage( image->pages[ i ], imageAddress( info, i ), PAGESIZE ) != YALNIX_NO_ERROR ){
+			TracePrintf( 5, "No memory to cache image %s\n", name );
+			freeImage( image );
+			return 0;
+		}
+	}
+
+	image->info = *info;
+	image->busy = 0;
+	image->bundled = 0;
+	return image;
+}
+
+static void addImage( struct image * image ){
+	pushImage( image );
+	cached_pages += image->npages;
+	TracePrintf( 5, "Cached image %s in %d pages\n", image->name, image->npages );
+}
+
+/* remember the text and initialized data of the program in fd that was
+ * just read into region 1. nothing happens if the program is too big for
+ * the cache or there is no memory for it.
+ */
+void cacheImage( const char * name, int fd, struct load_info * info ){
+	struct stat status;
+	struct image * image;
+
+	if ( fstat( fd, &status ) != 0 ){
+		return;
+	}
+	image = makeImage( name, info );
+	if ( ! image ){
+		return;
+	}
+	image->device = status.st_dev;
+	image->inode = status.st_ino;
+	image->size = status.st_size;
+	image->modified = status.st_mtime;
+	addImage( image );
+}
+
+/* same as cacheImage for a program that was read from the boot bundle.
+ * size and modified are what the bundle recorded for the program file.
+ */
+void cacheBundledImage( const char * name, off_t size, time_t modified, struct load_info * info ){
+	struct image * image = makeImage( name, info );
+	if ( ! image ){
+		return;
+	}
+	image->device = 0;
+	image->inode = 0;
+	image->size = size;
+	image->modified = modified;
+	image->bundled = 1;
+	addImage( image );
+}
+
+/* copy the text and initialized data of a cached image into region 1 */
+YalnixError copyImage( struct image * image ){
+	int i;
+	for ( i = 0; i < image->npages; i++ ){
+		YalnixError error = copyPageToBlock( image->pages[ i ], imageAddress( &image->info, i ), PAGESIZE );
+		if ( error != YALNIX_NO_ERROR ){
+			return error;
+		}
+	}
+	return YALNIX_NO_ERROR;
+}
@@ -10,11 +10,17 @@
 #include "process.h"
 #include "kernel.h"
 #include "schedule.h"
+#include "syscalls.h"
+#include "bundle.h"
+#include "sync.h"
+#include "pipe.h"
+#include "group.h"
 
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
 
 /* TODO:
  * move all the terminal stuff to terminal.c
@@ -26,14 +32,28 @@ struct service{
 	int port;
 	/* id of process that registered this service */
 	int id;
+	/* messages handed to this process through the port */
+	unsigned int served;
 };
 
 /* array of processes that have regiseterd themselves to provide some service
- * through ipc
+ * through ipc. several processes can register the same port and share its
+ * messages as a pool of workers.
  */
 static struct service * registered_servers = 0;
 static unsigned int max_servers = 0;
 
+/* ipc counters of every port that was ever sent to. they outlive the
+ * workers so a pool can be looked at after it is gone.
+ */
+struct port_stats{
+	int port;
+	struct ipc_stats stats;
+};
+
+static struct port_stats * port_stats = 0;
+static int max_port_stats = 0;
+
 /* these bitmasks have to start at 0x10 because they are bitwise or'd
  * with the tty number, i.e. TTY_READ | 1, for reading tty 1
  */
@@ -45,18 +65,30 @@ const int IPC_SEND = 1;
 const int IPC_RECEIVE = 2;
 const int IPC_REPLY = 3;
 
+/* bytes of output a terminal queues before writers have to wait */
+#define TTY_OUTPUT_SIZE (TERMINAL_MAX_LINE * 4)
+
+/* bytes of typed input a terminal keeps until someone reads them */
+#define TTY_INPUT_SIZE (TERMINAL_MAX_LINE * 4)
+
 /* representation of a terminal in the kernel */
 struct tty{
-	/* filled when the user types stuff into a terminal */
-	char input[ TERMINAL_MAX_LINE ];
-	/* filled when a process writes to a terminal */
-	char output[ TERMINAL_MAX_LINE ];
-	/* number of bytes currently in the *input* buffer
-	 * -1 signifies no bytes in the buffer.
+	/* lines the user typed that nobody has read yet, a ring with
+	 * input_count bytes starting at input_start
+	 */
+	char input[ TTY_INPUT_SIZE ];
+	int input_start;
+	int input_count;
+	/* output queued by TtyWrite, a ring with output_count bytes starting
+	 * at output_start
 	 */
-	int bytes;
-	/* 1 if this terminal is being used, 0 if free */
-	int busy;
+	char output[ TTY_OUTPUT_SIZE ];
+	int output_start;
+	int output_count;
+	/* bytes at output_start that TtyTransmit is sending, 0 when the
+	 * terminal is quiet
+	 */
+	int transmitting;
 };
 
 static struct tty terminals[ NUM_TERMINALS ];
@@ -68,6 +100,31 @@ static void panic( YalnixError error ){
 	Halt();
 }
 
+/* current time in microseconds */
+static unsigned long long now(){
+	struct timeval t;
+	gettimeofday( &t, NULL );
+	return (unsigned long long) t.tv_sec * 1000 * 1000 + t.tv_usec;
+}
+
+/* add the time since the process's last mark to counter and start a new period */
+static void chargeTime( struct process * process, unsigned long long * counter ){
+	unsigned long long time = now();
+	*counter += time - process->usage_mark;
+	process->usage_mark = time;
+}
+
+/* add the resources in 'more' to 'total' */
+static void addUsage( struct usage * total, const struct usage * more ){
+	total->user_time += more->user_time;
+	total->kernel_time += more->kernel_time;
+	total->blocked_time += more->blocked_time;
+	total->faults += more->faults;
+	total->syscalls += more->syscalls;
+	total->messages += more->messages;
+	total->sectors += more->sectors;
+}
+
 /* copy kernel stack to some pages */
 /*
 static void saveStack( struct memory_page ** stack ){
@@ -78,20 +135,6 @@ static void saveStack( struct memory_page ** stack ){
 }
 */
 
-/* copy existing kernel stack to some other pages. those pages do not
- * have to be mapped in, copyBlockToPage will map them in, copy data, then unmap them.
- */
-static YalnixError copyStack( struct memory_page ** pages, char * stack ){
-	int i;
-	for ( i = 0; i < KERNEL_STACK_PAGES; i++ ){
-		YalnixError error = copyBlockToPage( pages[ i ], stack + PAGESIZE * i, PAGESIZE );
-		if ( error != YALNIX_NO_ERROR ){
-			return error;
-		}
-	}
-	return YALNIX_NO_ERROR;
-}
-
 /* do a kernel context switch
  * 1. save the old kernel context in old process
  * 2. map new kernel stack
@@ -129,12 +172,15 @@ static void switchTo( struct process * old, struct process * new, UserContext *
 	*context = new->user_context;
 	setupPageTable( new->page_table, new->pages );
 	if ( old != 0 ){
+		chargeTime( old, &old->usage.kernel_time );
 		KernelContextSwitch( kernelProcess, old, new );
 	} else {
 		KernelContextSwitch( kernelProcessNew, old, new );
 	}
 
 	if ( old != 0 ){
+		/* old was taken off the run list to wait for something */
+		chargeTime( old, &old->usage.blocked_time );
 		*context = old->user_context;
 		setupPageTable( old->page_table, old->pages );
 	}
@@ -157,7 +203,10 @@ static void swapProcesses( UserContext * context ){
 		TracePrintf( 2, "Switch from pid %d to pid %d\n", old->id, new->id );
 		*context = new->user_context;
 		setupPageTable( new->page_table, new->pages );
+		chargeTime( old, &old->usage.kernel_time );
 		KernelContextSwitch( kernelProcess, old, new );
+		/* time spent waiting for a turn on the cpu is not charged */
+		old->usage_mark = now();
 		*context = old->user_context;
 		setupPageTable( old->page_table, old->pages );
 	}
@@ -174,9 +223,12 @@ static void dummyTrap( const char * trap, UserContext * context ){
 	TracePrintf( 1, "Pid %d Trap '%s'. Program counter( pc ) = %p\n", current_process->process->id, trap, context->pc );
 }
 
-/* helper function to call user_brk, which allocates memory in region 1 */
+/* helper function to call user_brk, which allocates memory in region 1.
+ * threads share the heap of their leader.
+ */
 static int allocateUserMemory( struct process * process, unsigned int limit ){
-	if ( limit < VMEM_1_LIMIT ){
+	process = process->leader;
+	if ( limit < VMEM_1_LIMIT && to_page( limit, 0 ) - to_page( VMEM_1_BASE, 0 ) < heapCeiling( process ) ){
 		int new_heap = user_brk( process->page_table, process->heap_start, process->heap_end, (void *) limit );
 		if ( new_heap == ERROR ){
 			/* TODO: if brk fails I could try to shrink the pages used
@@ -194,16 +246,6 @@ static int allocateUserMemory( struct process * process, unsigned int limit ){
 	}
 }
 
-KernelContext * KContextHelper(KernelContext *kContext, void *ptr1, void *ptr2) {
-	*((KernelContext*)ptr1) = *kContext;
-	memcpy((char *)ptr2,(char *)KERNEL_STACK_BASE, PAGESIZE * 2);
-	return (KernelContext*)ptr1;
-}
-
-void getCurrentKernelContext( KernelContext * context, char * stack ){
-	KernelContextSwitch(KContextHelper, context, stack );
-}
-
 /* Copy over all region 1 memory
  */
 static YalnixError copyRegion1( struct process * parent, struct process * child ){
@@ -212,6 +254,8 @@ static YalnixError copyRegion1( struct process * parent, struct process * child
 	child->heap_start = parent->heap_start;
 	child->heap_end = parent->heap_end;
 	child->stack = parent->stack;
+	/* the child gets its own copy of the shared window but keeps the layout */
+	child->shared_pages = parent->shared_pages;
 	for ( i = 0; i < parent->pages; i++ ){
 		if ( parent->page_table[ i ] != 0 ){
 			struct memory_page * page = get_free_page();
@@ -221,13 +265,13 @@ static YalnixError copyRegion1( struct process * parent, struct process * child
 			child->page_table[ i ] = page;
 			TracePrintf( 12, "[%d] Copy region 1 %d from [%d]. Physical %d\n", child->id, i, parent->id, page->frame );
 			page->protection = PROT_READ | PROT_WRITE;
-			ret = copyBlockToPage( page, (void *)((parent->page_table[ i ]->virtual << PAGESHIFT) + VMEM_1_BASE), PAGESIZE );
+			ret = copyBlockToPage( page, (void *)((i << PAGESHIFT) + VMEM_1_BASE), PAGESIZE );
 			if ( ret != YALNIX_NO_ERROR ){
 				TracePrintf( 7, "[%d] Could not copy page\n", child->id );
 				return ret;
 			}
 			page->protection = parent->page_table[ i ]->protection;
-			page->virtual = parent->page_table[ i ]->virtual;
+			page->virtual = i;
 		} else {
 			child->page_table[ i ] = 0;
 		}
@@ -236,11 +280,75 @@ static YalnixError copyRegion1( struct process * parent, struct process * child
 	return ret;
 }
 
+/* save the kernel context in the child and copy the kernel stack straight
+ * into the child's stack frames. ptr2 is where the result of the copy goes.
+ */
+static KernelContext * KContextClone( KernelContext * context, void * ptr1, void * ptr2 ){
+	struct process * child = (struct process *) ptr1;
+	child->kernel_context = *context;
+	*((YalnixError *) ptr2) = copyKernelStack( child->kernel_stack );
+	return context;
+}
+
+/* give every process in the run list the current kernel context and stack.
+ * ptr2 is where the result of the copy goes.
+ */
+static KernelContext * KContextStart( KernelContext * context, void * ptr1, void * ptr2 ){
+	struct process_list * list = (struct process_list *) ptr1;
+	YalnixError * ret = (YalnixError *) ptr2;
+	do{
+		struct process * p = list->process;
+		p->kernel_context = *context;
+		p->usage_mark = now();
+		TracePrintf( 5, "Copy stack to pid %d\n", p->id );
+		*ret = copyKernelStack( p->kernel_stack );
+		if ( *ret != YALNIX_NO_ERROR ){
+			break;
+		}
+		list = list->next;
+	} while ( list != (struct process_list *) ptr1 );
+	return context;
+}
+
+/* snapshot the current kernel context and stack into child so that the child
+ * starts running from this point the first time it is switched to.
+ * returns 1 when the original process returns from this function, 0 when the
+ * child returns from it and ERROR if the stack could not be copied.
+ */
+static int cloneKernel( struct process * child ){
+	YalnixError ret = YALNIX_NO_ERROR;
+	int parent_id = current_process->process->id;
+
+	KernelContextSwitch( KContextClone, child, &ret );
+	/* current_process is different depending on if the parent or child
+	 * is executing. the child cannot execute until the parent puts it
+	 * in the run list.
+	 */
+	if ( current_process->process->id != parent_id ){
+		current_process->process->usage_mark = now();
+		return 0;
+	}
+
+	if ( ret != YALNIX_NO_ERROR ){
+		TracePrintf( 2, "[%d] Could not copy kernel stack to pid %d\n", parent_id, child->id );
+		return ERROR;
+	}
+	return 1;
+}
+
+static void setPipes( struct process * process, int in, int out );
+
 /* spawn a new process, copy over region 1, and set up the kernel stack
  */
 static void handleFork( UserContext * context ){
-	struct process * child = createProcess();
 	struct process * parent = current_process->process;
+	/* only the calling thread would be copied so don't allow it */
+	if ( parent->leader != parent || parent->threads > 0 ){
+		context->regs[ 0 ] = ERROR;
+		return;
+	}
+
+	struct process * child = createProcess();
 	if ( ! child ){
 		context->regs[ 0 ] = ERROR;
 		return;
@@ -248,6 +356,7 @@ static void handleFork( UserContext * context ){
 
 	struct process_list * list = (struct process_list *) malloc( sizeof( struct process_list ) );
 	if ( ! list ){
+		freeProcess( child );
 		context->regs[ 0 ] = ERROR;
 		return;
 	}
@@ -255,8 +364,6 @@ static void handleFork( UserContext * context ){
 	child->list = list;
 
 	YalnixError ret;
-	KernelContext forkContext;
-	char * forkStack;
 	int parent_id = parent->id;
 	int child_id = child->id;
 	ret = copyRegion1( parent, child );
@@ -268,46 +375,29 @@ static void handleFork( UserContext * context ){
 		context->regs[ 0 ] = ERROR;
 		return;
 	}
-	forkStack = malloc( PAGESIZE * 2 );
-	if ( ! forkStack ){
-		TracePrintf( 2, "Could not malloc fork stack\n" );
-		freeProcess( child );
-		free( list );
-		context->regs[ 0 ] = ERROR;
-		return;
-	}
 
-	if ( addChildToProcess( parent, child ) != 0 ){
-		TracePrintf( 2, "Could not add child to process\n" );
-		freeProcess( child );
-		free( forkStack );
-		free( list );
-		context->regs[ 0 ] = ERROR;
-		return;
+	switch ( cloneKernel( child ) ){
+		case 0 : {
+			TracePrintf( 2, "[%d] In fork\n", current_process->process->id );
+			/* return for child is 0 */
+			context->regs[ 0 ] = 0;
+			return;
+		}
+		case ERROR : {
+			freeProcess( child );
+			free( list );
+			context->regs[ 0 ] = ERROR;
+			return;
+		}
 	}
 
-	addToRunList( list );
-	child->parent = parent;
-
-	getCurrentKernelContext( &forkContext, forkStack );
-	/* current_process is different depending on if the parent or child
-	 * is executing
-	 */
 	TracePrintf( 2, "[%d] In fork\n", current_process->process->id );
+	setPipes( child, parent->pipe_in, parent->pipe_out );
+	addChildToProcess( parent, child );
+	addToRunList( list );
 
-	/* only copy the kernel stack to the new process if we are the parent
-	 * that is still executing. the child cannot execute until this occurs anyway
-	 */
-	if ( current_process->process->id == parent_id ){
-		child->kernel_context = forkContext;
-		ret = copyStack( child->kernel_stack, forkStack );
-		free( forkStack );
-		/* return for parent is the pid of the child */
-		context->regs[ 0 ] = child_id;
-	} else {
-		/* return for child is 0 */
-		context->regs[ 0 ] = 0;
-	}
+	/* return for parent is the pid of the child */
+	context->regs[ 0 ] = child_id;
 }
 
 /* take parent out of whatever list its currently in and put
@@ -327,435 +417,702 @@ static void wakeupParent( struct process * parent ){
 	current_process->next = list;
 }
 
-static void notifyParentOfDeath( struct process * parent, struct process * child, int code ){
-	int index = 0;
-	struct status_list * status;
+/* processes sleeping with a timeout, linked through process->next_timer.
+ * the clock counts them down and wakes up the ones that run out.
+ */
+static struct process * timers = 0;
+
+/* wake process up after 'ticks' clock ticks unless stopTimer is called first */
+static void startTimer( struct process * process, int ticks ){
+	process->timer = ticks;
+	process->timed_out = 0;
+	process->next_timer = timers;
+	timers = process;
+}
+
+/* take process off the timer list if it is on it */
+static void stopTimer( struct process * process ){
+	struct process ** link;
+	for ( link = &timers; *link != 0; link = &(*link)->next_timer ){
+		if ( *link == process ){
+			*link = process->next_timer;
+			process->next_timer = 0;
+			return;
+		}
+	}
+}
+
+/* count down the timers. a process whose timer runs out is woken up
+ * with timed_out set
+ */
+static void updateTimers(){
+	struct process ** link = &timers;
+	while ( *link != 0 ){
+		struct process * process = *link;
+		process->timer -= 1;
+		if ( process->timer <= 0 ){
+			TracePrintf( 6, "[%d] timed out\n", process->id );
+			*link = process->next_timer;
+			process->next_timer = 0;
+			process->timed_out = 1;
+			wakeupParent( process );
+		} else {
+			link = &process->next_timer;
+		}
+	}
+}
 
-	for ( index = 0; index < parent->max_children && parent->children[ index ] != child; index++ ){
+/* processes blocked in Select, linked through process->next_waiter */
+static struct process * selectors = 0;
+
+static void removeSelector( struct process * process ){
+	struct process ** link;
+	for ( link = &selectors; *link != 0; link = &(*link)->next_waiter ){
+		if ( *link == process ){
+			*link = process->next_waiter;
+			process->next_waiter = 0;
+			return;
+		}
+	}
+}
+
+/* wake up the processes in Select that wait for any of 'events' and
+ * belong to process id, or to anybody if id is -1. they check again what
+ * is ready so waking too many is harmless.
+ */
+static void wakeSelectors( int id, int events ){
+	struct process ** link = &selectors;
+	while ( *link != 0 ){
+		struct process * process = *link;
+		if ( (process->select_events & events) &&
+		     (id == -1 || process->id == id || process->leader->id == id) ){
+			*link = process->next_waiter;
+			process->next_waiter = 0;
+			wakeupParent( process );
+		} else {
+			link = &process->next_waiter;
+		}
+	}
+}
+
+/* wake up everybody on a queue. they have to check again whatever they
+ * were waiting for
+ */
+static void wakeAll( struct wait_queue * queue ){
+	struct process * waiter;
+	while ( (waiter = dequeueWaiter( queue )) != 0 ){
+		wakeupParent( waiter );
+	}
+}
+
+/* free a pipe once neither end of it is used */
+static void dropPipe( int handle ){
+	struct pipe * pipe = findPipe( handle );
+	if ( pipe && pipe->readers == 0 && pipe->writers == 0 ){
+		/* threads of a process that redirected away could still be waiting */
+		wakeAll( &pipe->read_waiters );
+		wakeAll( &pipe->write_waiters );
+		freePipe( handle );
+	}
+}
+
+/* free the pipes process id made that nobody is redirected to */
+static void dropCreatedPipes( int id ){
+	int handle;
+	for ( handle = 0; handle < MAX_PIPES; handle++ ){
+		struct pipe * pipe = findPipe( handle );
+		if ( pipe && pipe->creator == id ){
+			dropPipe( handle );
+		}
+	}
+}
+
+/* point the input and output of process at pipes in and out, -1 for the
+ * terminal. readers get end of file once the last writer is gone and
+ * writers fail once the last reader is gone.
+ */
+static void setPipes( struct process * process, int in, int out ){
+	int old_in = process->pipe_in;
+	int old_out = process->pipe_out;
+	struct pipe * pipe;
+
+	/* take the new ends first so a pipe that is kept is never freed */
+	if ( (pipe = findPipe( in )) != 0 ){
+		pipe->readers += 1;
 	}
+	if ( (pipe = findPipe( out )) != 0 ){
+		pipe->writers += 1;
+	}
+	process->pipe_in = in;
+	process->pipe_out = out;
+
+	if ( (pipe = findPipe( old_in )) != 0 ){
+		pipe->readers -= 1;
+		if ( pipe->readers == 0 ){
+			wakeAll( &pipe->write_waiters );
+		}
+		dropPipe( old_in );
+	}
+	if ( (pipe = findPipe( old_out )) != 0 ){
+		pipe->writers -= 1;
+		if ( pipe->writers == 0 ){
+			wakeAll( &pipe->read_waiters );
+		}
+		dropPipe( old_out );
+	}
+}
+
+static void notifyParentOfDeath( struct process * parent, struct process * child, int code ){
+	struct status_list * status;
 
-	if ( index == parent->max_children ){
+	if ( child->parent != parent ){
 		/* this should never happen */
 		panic( YALNIX_INVALID_CHILD );
 	}
 
-	/* put the parent back on the run list */
-	wakeupParent( parent );
+	/* put the parent back on the run list, but only if it is waiting
+	 * for this child
+	 */
+	if ( parent->status == PROCESS_WAIT_FOR_DEAD_CHILD &&
+	     (parent->wait_for == -1 || parent->wait_for == child->id) ){
+		wakeupParent( parent );
+	}
+
+	wakeSelectors( parent->id, SELECT_CHILD );
 
-	/* child is not alive anymore, so mark its index as dead */
-	parent->children[ index ] = 0;
+	/* child is not alive anymore so take it out of the parent's children */
+	removeChildFromProcess( parent, child );
 
-	/* add an object to the list of children that have terminated */
+	/* add an object to the end of the list of children that have terminated */
 	status = (struct status_list *) malloc( sizeof(struct status_list) );
 	if ( status ){
 		status->status = code;
 		status->id = child->id;
-		status->next = parent->terminated.next;
-		parent->terminated.next = status;
+		status->usage = child->usage;
+		addUsage( &status->usage, &child->child_usage );
+		status->next = 0;
+		parent->last_terminated->next = status;
+		parent->last_terminated = status;
 	}
 	/* if status was 0, meaning malloc failed, then in the worst case
 	 * the parent will get an error when he calls Wait(). oh well!
 	 */
 }
 
-/* relinquish control from all ports owned by this process */
+static struct service * findService( int port );
+
+/* relinquish control from all ports owned by this process. senders
+ * waiting on a port without workers left are woken up to fail.
+ */
 static void deregisterServers( struct process * process ){
 	int id = process->id;
 	int i = 0;
 	for ( i = 0; i < max_servers; i++ ){
 		if ( registered_servers[ i ].id == id ){
-			registered_servers[ i ] = (struct service) { .port = 0, .id = -1 };
+			int port = registered_servers[ i ].port;
+			struct process_list * sender;
+			registered_servers[ i ] = (struct service) { .port = 0, .id = -1, .served = 0 };
+			while ( ! findService( port ) && (sender = findPortSender( port )) != 0 ){
+				((struct ipc *) sender->obj)->port = 0;
+				wakeupParent( sender->process );
+			}
 		}
 	}
 }
 
-/* a process died for whatever reason. notify the parent of its
- * untimely death and clean up and resources it used
- */
-static void doExit( struct process * process, int code ){
-	int i;
-	TracePrintf( 6, "[%d] exiting with code %d\n", process->id, code );
-	if ( process->parent ){
-		notifyParentOfDeath( process->parent, process, code );
-	}
-	process->status = PROCESS_DIED;
+/* make children orphans. sorry kids! */
+static void orphanChildren( struct process * process ){
+	struct process * child = process->first_child;
+	while ( child != 0 ){
+		struct process * next = child->next_sibling;
+		child->parent = 0;
+		child->next_sibling = 0;
+		child->prev_sibling = 0;
+		child = next;
+	}
+	process->first_child = 0;
+	process->live_children = 0;
+}
 
-	for ( i = 0; i < process->max_children; i++ ){
-		/* make children orphans. sorry kids! */
-		if ( process->children[ i ] ){
-			process->children[ i ]->parent = 0;
-		}
+/* give a lock to the oldest process waiting for it, or make it free */
+static void handOffLock( struct sync_object * lock ){
+	struct process * next = dequeueWaiter( &lock->waiters );
+	lock->holder = next;
+	if ( next ){
+		TracePrintf( 6, "[%d] handed a lock\n", next->id );
+		wakeupParent( next );
 	}
-
-	deregisterServers( process );
-
-	removeProcess( process );
 }
 
-/* overlay a new program onto the current process
- */
-static int handleExec( UserContext * context ){
-	char * filename = (char *)context->regs[ 0 ];
-	char ** args = (char **) context->regs[ 1 ];
-	char ** f;
-	int i;
-	struct process * process = current_process->process;
-	int error = 0;
-	/* if the user passed in arguments not in region 1 then fail */
-	if ( ! ensureRegion1StringRead( filename ) ){
-		return ERROR;
-	}
-	for ( f = args; *f != 0; f++ ){
-		if ( ! ensureRegion1Read( f, sizeof(char**) ) ){
-			return ERROR;
-		}
-		if ( ! ensureRegion1StringRead( *f ) ){
-			return ERROR;
-		}
+/* locks of a dead process would never be released otherwise */
+static void releaseLocks( struct process * process ){
+	struct sync_object * lock;
+	while ( (lock = findHeldLock( process )) != 0 ){
+		TracePrintf( 4, "[%d] releasing lock at exit\n", process->id );
+		handOffLock( lock );
 	}
+}
 
-	char * keep = filename;
-	/* all arguments from the user have to be copied into some scratch space */
-	filename = (char *) malloc( strlen( keep ) + 1 );
-	if ( ! filename ){
-		return ERROR;
-	}
-	strcpy( filename, (char *) context->regs[ 0 ] );
+static void endThread( struct process * process, int code );
 
-	i = 0;
-	for ( ; *args != 0; args++, i++ ){
-		/**/
-	}
-	
-	args = (char **) malloc( sizeof(char *) * i + 1 );
-	if ( ! args ){
-		free( filename );
-		return ERROR;
-	}
-	/* copy argv */
-	f = (char **) context->regs[ 1 ];
-	for ( i = 0; f[ i ] != 0; i++ ){
-		args[ i ] = malloc( strlen( f[ i ] ) + 1 );
-		if ( ! args[ i ] ){
-			int q = 0;
-			for ( q = 0; q < i; q++ ){
-				free( args[ q ] );
-				free( args );
-				free( filename );
-				return ERROR;
-			}
-		}
-		strcpy( args[ i ], f[ i ] );
-	}
-	args[ i ] = 0;
+/* a thread died. keep its exit status for ThreadJoin, wake up whoever is
+ * joining it and give back its stack. the last thread of a leader that
+ * already exited takes the leader down with it.
+ */
+static void doExitThread( struct process * thread, int code ){
+	struct process * leader = thread->leader;
+	struct status_list * status;
 
-	TracePrintf( 2, "[%d] Try to exec %s\n", process->id, filename );
+	TracePrintf( 6, "[%d] thread exiting with code %d\n", thread->id, code );
+	thread->status = PROCESS_DIED;
+	orphanChildren( thread );
 
-	error = loadProgram( process, filename, args );
-	TracePrintf( 2, "[%d] Exec result %d\n", process->id, error );
-	if ( error == YALNIX_INVALID_PROGRAM ){
-		TracePrintf( 2, "[%d] Could not exec '%s'\n", process->id, filename );
-		free( filename );
-		for ( i = 0; args[ i ] != 0; i++ ){
-			free( args[ i ] );
-		}
-		free( args );
-		struct process_list * save = current_process->next;
-		doExit( process, ERROR );
-		current_process = save;
-		// swapProcesses( context );
-		switchTo( 0, current_process->process, context );
-		/* doesn't get here */
-	} else if ( error == 0 ){
-		*context = process->user_context;
+	status = (struct status_list *) malloc( sizeof(struct status_list) );
+	if ( status ){
+		status->status = code;
+		status->id = thread->id;
+		status->next = leader->thread_exits.next;
+		leader->thread_exits.next = status;
 	}
-	
-	for ( i = 0; args[ i ] != 0; i++ ){
-		free( args[ i ] );
+
+	if ( thread->joiner ){
+		wakeupParent( thread->joiner );
+		thread->joiner = 0;
 	}
-	
-	free( args );
-	free( filename );
 
-	return error;
-}
+	/* the resources of a thread belong to its process */
+	addUsage( &leader->usage, &thread->usage );
+	addUsage( &leader->child_usage, &thread->child_usage );
 
-static void handleExit( struct process * process, int code ){
-	doExit( process, code );
-}
+	removeThreadFromProcess( leader, thread );
 
-/* returns the number of non-0 pointers in obj */
-static int countObjects( void ** obj, int max ){
-	int count = 0;
-	int i;
-	for ( i = 0; i < max; i++ ){
-		if ( obj[ i ] ){
-			count += 1;
-		}
+	if ( leader->threads == 0 && leader->status == PROCESS_DIED ){
+		endThread( leader, leader->exit_code );
 	}
-	return count;
+
+	removeProcess( thread );
 }
 
-/* wait for dead children */
-static int handleWait( UserContext * context, struct process * process, int * status ){
-	if ( ! ensureRegion1ReadWrite( status, sizeof( int ) ) ){
-		return ERROR;
+/* one thread of a process is done. a thread goes right away, a leader
+ * that still has threads waits for them. once the leader goes notify the
+ * parent of its untimely death and clean up and resources it used
+ */
+static void endThread( struct process * process, int code ){
+	if ( process == current_process->process ){
+		chargeTime( process, &process->usage.kernel_time );
 	}
 
-	/* a goto here is more convenient than a while loop. if the process
-	 * goes to sleep because its waiting for a child to die then it will
-	 * jump back to here after being woken up. besides goto's make me
-	 * feel like I'm using tail recursion.
-	 */
-	try_again:
-	TracePrintf( 4, "[%d] waiting for dead children\n", process->id );
-	/* see if any children have died so we can return one of them */
-	if ( process->terminated.next != 0 ){
-		struct status_list * list = process->terminated.next;
-		int id = list->id;
-		process->terminated.next = list->next;
-		*status = list->status;
-		free( list );
-		return id;
+	releaseLocks( process );
+	stopTimer( process );
+	removeSelector( process );
+
+	if ( process->leader != process ){
+		doExitThread( process, code );
+		return;
 	}
 
-	/* otherwise wait for a child to die */
-	if ( countObjects( (void **) process->children, process->max_children ) > 0 ){
-		/* dont run until a child has died */
+	TracePrintf( 6, "[%d] exiting with code %d\n", process->id, code );
+	process->status = PROCESS_DIED;
+	orphanChildren( process );
 
-		struct process_list * save = current_process->next;
-		struct process * old = current_process->process;
+	/* the address space is still in use, so the leader is taken off
+	 * the scheduler and finished off by its last thread
+	 */
+	if ( process->threads > 0 ){
 		struct process_list * list = process->list;
+		TracePrintf( 6, "[%d] waiting for %d threads to exit\n", process->id, process->threads );
+		process->exit_code = code;
 		if ( list->prev ){
 			list->prev->next = list->next;
 		}
 		if ( list->next ){
 			list->next->prev = list->prev;
 		}
+		list->next = 0;
+		list->prev = 0;
+		return;
+	}
 
-		addToBusyList( list );
-
-		current_process = skipIdle( save );
-		switchTo( old, current_process->process, context );
-		/* when the process comes back it will reap some children */
+	setPipes( process, -1, -1 );
+	dropCreatedPipes( process->id );
+	leaveGroups( process->id );
 
-		goto try_again;
+	if ( process->parent ){
+		notifyParentOfDeath( process->parent, process, code );
 	}
 
-	TracePrintf( 2, "[%d] No children left\n", process->id );
+	deregisterServers( process );
 
-	return ERROR;
+	removeProcess( process );
 }
 
-/* put process in the delay list and take it off of the run queue */
-static int handleDelay( struct process * process, int time ){
+/* end a thread of a dying process that is not the one running. it is
+ * taken out of whatever it sleeps on first: the run, busy, ipc, io or
+ * delay list with its scratch object, a semaphore, lock, cvar, futex or
+ * pipe queue, the timer and selector lists and a ThreadJoin.
+ */
+static void endOtherThread( struct process * process, int code ){
+	struct process * leader = process->leader;
+	struct process * thread;
 	struct process_list * list = process->list;
 
-	if ( time == 0 ){
-		return 0;
+	TracePrintf( 4, "[%d] killed by the exit of its process\n", process->id );
+	forgetWaiter( process );
+	forgetPipeWaiter( process );
+	for ( thread = leader->first_thread; thread != 0; thread = thread->next_thread ){
+		if ( thread->joiner == process ){
+			thread->joiner = 0;
+		}
 	}
+	free( list->obj );
+	list->obj = 0;
+	endThread( process, code );
+}
 
-	if ( time < 0 ){
-		return ERROR;
-	}
+/* 1 if process can be ended right away by another thread. the current
+ * process ends itself, one waiting for the disk can't let go of the
+ * buffer, and a leader that already exited is waiting for its threads.
+ */
+static int canEndNow( struct process * process ){
+	return process != current_process->process &&
+	       ! onDiskList( process->list ) &&
+	       process->status != PROCESS_DIED;
+}
 
-	int * delay = (int *) malloc( sizeof( int ) );
-
-	if ( ! delay ){
-		return ERROR;
+/* a process is going away. end the leader and every thread of it except
+ * the current process, wherever they are blocked. a thread waiting for
+ * the disk is marked and goes once its transfer is done. the first Exit
+ * of a process decides the exit code.
+ */
+static void killThreads( struct process * leader, int code ){
+	struct process * thread;
+	struct process * next;
+	if ( ! leader->killed ){
+		leader->killed = 1;
+		leader->exit_code = code;
+	}
+	for ( thread = leader->first_thread; thread != 0; thread = thread->next_thread ){
+		thread->killed = 1;
 	}
 
-	if ( list->prev ){
-		list->prev->next = list->next;
+	/* the leader first, with threads left it only parks. the last
+	 * thread ended below then finishes it off.
+	 */
+	if ( canEndNow( leader ) ){
+		endOtherThread( leader, leader->exit_code );
 	}
-	if ( list->next ){
-		list->next->prev = list->prev;
+	for ( thread = leader->first_thread; thread != 0; thread = next ){
+		next = thread->next_thread;
+		if ( canEndNow( thread ) ){
+			endOtherThread( thread, leader->exit_code );
+		}
 	}
+}
 
-	*delay = time;
-	list->obj = delay;
-
-	addToDelayedList( list );
+/* the current process died for whatever reason. it and every other
+ * thread of its process go, then the next process runs.
+ */
+static void exitCurrent( UserContext * context, int code ){
+	struct process * process = current_process->process;
+	struct process_list * save;
+	killThreads( process->leader, code );
+	/* killThreads may have taken the next process off the run list */
+	save = current_process->next;
+	endThread( process, code );
+	current_process = skipIdle( save );
+	switchTo( 0, current_process->process, context );
+}
 
-	TracePrintf( 4, "[%d] Delay for %d ticks\n", process->id, time );
+/* finish off the current process if another of its threads called Exit
+ * while it was waiting for the disk. returns 1 if it was killed.
+ */
+static int exitIfKilled( UserContext * context ){
+	struct process * process = current_process->process;
+	if ( isIdle( current_process ) || ! process->killed ){
+		return 0;
+	}
 
+	TracePrintf( 4, "[%d] killed by the exit of its process\n", process->id );
+	exitCurrent( context, process->leader->exit_code );
 	return 1;
 }
 
-/* Copy max of (terminal->bytes, length) bytes into buffer.
- * If length is less than terminal->bytes than the bytes from
- * length to terminal->bytes is shifted left length bytes.
- */
-static int copyFromTty( struct tty * terminal, void * buffer, int length ){
-	int read = 0;
-	if ( length == terminal->bytes ){
-		memcpy( buffer, terminal->input, length );
-		read = terminal->bytes;
-		terminal->bytes = -1;
-	} else if ( length < terminal->bytes ){
-		char tmp[ TERMINAL_MAX_LINE ];
-		memcpy( buffer, terminal->input, length );
-		read = length;
-		memcpy( tmp, terminal->input + length, terminal->bytes - length );
-		memcpy( terminal->input, tmp, terminal->bytes - length );
-		terminal->bytes -= read;
-	} else if ( length > terminal->bytes ){
-		memcpy( buffer, terminal->input, terminal->bytes );
-		read = terminal->bytes;
-		terminal->bytes = -1;
+/* free the scratch copies made by copyArguments */
+static void freeArguments( char * filename, char ** args ){
+	int i;
+	for ( i = 0; args[ i ] != 0; i++ ){
+		free( args[ i ] );
 	}
-	return read;
+	free( args );
+	free( filename );
 }
 
-/* read from bytes from a terminal. this process will sleep if
- * the terminal is in use.
+/* all arguments from the user have to be copied into some scratch space
+ * before region 1 is thrown away. returns 0 on success or ERROR if the
+ * arguments are not in region 1 or there is not enough memory.
  */
-static int handleTtyRead( UserContext * context, struct process * process, int tty, void * buffer, int length ){
-	if ( ! ensureRegion1ReadWrite( buffer, length ) ){
-		return ERROR;	
+static int copyArguments( char * user_filename, char ** user_args, char ** filename, char *** args ){
+	char ** f;
+	int i;
+
+	/* if the user passed in arguments not in region 1 then fail */
+	if ( ! ensureRegion1StringRead( user_filename ) ){
+		return ERROR;
+	}
+	for ( f = user_args; ensureRegion1Read( f, sizeof(char**) ) && *f != 0; f++ ){
+		if ( ! ensureRegion1StringRead( *f ) ){
+			return ERROR;
+		}
+	}
+	if ( ! ensureRegion1Read( f, sizeof(char**) ) ){
+		return ERROR;
 	}
 
-	if ( tty >= 0 && tty < NUM_TERMINALS ){
-		struct tty * terminal = &terminals[ tty ];
-		try_again:
-		/* something is already in the terminal */
-		if ( terminal->bytes != -1 ){
-			return copyFromTty( terminal, buffer, length );
-		} else {
-			/* otherwise add this process to the i/o list */
-			int * tty_num = (int *) malloc( sizeof(int) );
-			if ( ! tty_num ){
-				return -1;
-			}
+	*filename = (char *) malloc( strlen( user_filename ) + 1 );
+	if ( ! *filename ){
+		return ERROR;
+	}
+	strcpy( *filename, user_filename );
 
-			*tty_num = tty | TTY_READ;
+	*args = (char **) malloc( sizeof(char *) * (f - user_args + 1) );
+	if ( ! *args ){
+		free( *filename );
+		return ERROR;
+	}
 
-			struct process_list * save = current_process->next;
-			struct process * old = current_process->process;
+	/* copy argv */
+	for ( i = 0; user_args[ i ] != 0; i++ ){
+		(*args)[ i ] = malloc( strlen( user_args[ i ] ) + 1 );
+		if ( ! (*args)[ i ] ){
+			freeArguments( *filename, *args );
+			return ERROR;
+		}
+		strcpy( (*args)[ i ], user_args[ i ] );
+		/* keep the array terminated so freeArguments works on failure */
+		(*args)[ i + 1 ] = 0;
+	}
+	(*args)[ i ] = 0;
 
-			struct process_list * list = process->list;
-			if ( list->prev ){
-				list->prev->next = list->next;
-			}
-			if ( list->next ){
-				list->next->prev = list->prev;
-			}
+	return 0;
+}
 
-			/* keep track of the tty for this process */
-			list->obj = tty_num;
+/* overlay a new program onto the current process
+ */
+static int handleExec( UserContext * context ){
+	char * filename;
+	char ** args;
+	struct process * process = current_process->process;
+	int error = 0;
 
-			addToIoList( list );
+	/* the other threads would lose their address space */
+	if ( process->leader != process || process->threads > 0 ){
+		return ERROR;
+	}
 
-			current_process = skipIdle( save );
-			switchTo( old, current_process->process, context );
-			/* when this process comes back it will try to read from the tty again */
-			goto try_again;
-		}
-	} else {
+	if ( copyArguments( (char *) context->regs[ 0 ], (char **) context->regs[ 1 ], &filename, &args ) != 0 ){
 		return ERROR;
 	}
+
+	TracePrintf( 2, "[%d] Try to exec %s\n", process->id, filename );
+
+	error = loadProgram( process, filename, args );
+	TracePrintf( 2, "[%d] Exec result %d\n", process->id, error );
+	if ( error == YALNIX_INVALID_PROGRAM ){
+		TracePrintf( 2, "[%d] Could not exec '%s'\n", process->id, filename );
+		freeArguments( filename, args );
+		exitCurrent( context, ERROR );
+		/* doesn't get here */
+	} else if ( error == 0 ){
+		*context = process->user_context;
+	}
+	
+	freeArguments( filename, args );
+
+	return error;
 }
 
-/* a process wants to write into a tty. if the tty is free then send the write along
- * via TtyTransmit and add the process to the io list waiting for the transmit to finish.
- * if the tty is busy then add the process to the io list waiting for the tty to become free
+/* start a new program in a child process. unlike Fork followed by Exec the
+ * parent's region 1 is never copied, loadProgram builds the child's address
+ * space from scratch.
  */
-static int handleTtyWrite( UserContext * context, struct process * process, int tty, void * buffer, int length ){
-	if ( ! ensureRegion1Read( buffer, length ) ){
-		return ERROR;
+static void handleSpawn( UserContext * context, char * user_filename, char ** user_args ){
+	struct process * parent = current_process->process;
+	struct process * child;
+	struct process_list * list;
+	char * filename;
+	char ** args;
+	int error;
+
+	if ( copyArguments( user_filename, user_args, &filename, &args ) != 0 ){
+		context->regs[ 0 ] = ERROR;
+		return;
 	}
-	if ( length == 0 ){
-		return ERROR;
+
+	child = createProcess();
+	if ( ! child ){
+		freeArguments( filename, args );
+		context->regs[ 0 ] = ERROR;
+		return;
 	}
-	if ( tty >= 0 && tty < NUM_TERMINALS ){
-		struct tty * terminal = &terminals[ tty ];
-		int * tty_num = (int *) malloc( sizeof(int) );
-		if ( ! tty_num ){
-			return ERROR;
-		}
 
-		/* wait for terminal to become free. when the process wakes up
-		 * the terminal is not necessarily free, so it has to be continually
-		 * checked.
-		 */
-		while ( terminal->busy ){
-			TracePrintf( 4, "[%d] waiting for tty %d\n", process->id, tty );
-			/*
-			swapProcesses( context );
-			*/
-			struct process_list * save = current_process->next;
-			struct process * old = current_process->process;
+	list = (struct process_list *) malloc( sizeof( struct process_list ) );
+	if ( ! list ){
+		freeArguments( filename, args );
+		freeProcess( child );
+		context->regs[ 0 ] = ERROR;
+		return;
+	}
+	list->process = child;
+	child->list = list;
 
-			struct process_list * list = process->list;
-			if ( list->prev ){
-				list->prev->next = list->next;
-			}
-			if ( list->next ){
-				list->next->prev = list->prev;
-			}
+	TracePrintf( 2, "[%d] Try to spawn %s as pid %d\n", parent->id, filename, child->id );
 
-			*tty_num = tty | TTY_WAIT | TTY_WRITE;
+	/* loadProgram writes the program through region 1 so the parent's
+	 * pages have to be mapped back in afterwards
+	 */
+	error = loadProgram( child, filename, args );
+	setupPageTable( parent->page_table, parent->pages );
+	if ( error != 0 ){
+		TracePrintf( 2, "[%d] Could not spawn '%s'\n", parent->id, filename );
+		freeArguments( filename, args );
+		freeProcess( child );
+		free( list );
+		context->regs[ 0 ] = ERROR;
+		return;
+	}
+	freeArguments( filename, args );
 
-			/* keep track of the tty for this process */
-			list->obj = tty_num;
+	switch ( cloneKernel( child ) ){
+		case 0 : {
+			/* the child starts at the entry point of its program */
+			*context = current_process->process->user_context;
+			return;
+		}
+		case ERROR : {
+			freeProcess( child );
+			free( list );
+			context->regs[ 0 ] = ERROR;
+			return;
+		}
+	}
 
-			addToIoList( list );
+	setPipes( child, parent->leader->pipe_in, parent->leader->pipe_out );
+	addChildToProcess( parent, child );
+	addToRunList( list );
 
-			current_process = skipIdle( save );
-			switchTo( old, current_process->process, context );
-		}
+	context->regs[ 0 ] = child->id;
+}
 
-		TracePrintf( 3, "[%d] writing to terminal %d\n", process->id, tty );
+/* start a thread running func( arg ) on its own stack in the address space
+ * of the current process. the thread has its own kernel stack and is
+ * scheduled like any other process.
+ */
+static void handleThreadCreate( UserContext * context, void * func, int arg ){
+	struct process * creator = current_process->process;
+	struct process * thread;
+	struct process_list * list;
+	char * top;
 
-		terminal->busy = 1;
-		if ( length > TERMINAL_MAX_LINE ){
-			length = TERMINAL_MAX_LINE;
-		}
-		memcpy( terminal->output, buffer, length );
-		TtyTransmit( tty, terminal->output, length );
+	if ( ! ensureRegion1Read( func, 1 ) ){
+		context->regs[ 0 ] = ERROR;
+		return;
+	}
 
-		/* move process of run list into io list */
-		struct process_list * save = current_process->next;
-		struct process * old = current_process->process;
+	list = (struct process_list *) malloc( sizeof( struct process_list ) );
+	if ( ! list ){
+		context->regs[ 0 ] = ERROR;
+		return;
+	}
 
-		struct process_list * list = process->list;
-		if ( list->prev ){
-			list->prev->next = list->next;
+	thread = createThread( creator->leader );
+	if ( ! thread ){
+		free( list );
+		context->regs[ 0 ] = ERROR;
+		return;
+	}
+	list->process = thread;
+	thread->list = list;
+
+	/* func gets arg as its only argument. there is nowhere sensible to
+	 * return to so the return address is 0, threads have to call ThreadExit.
+	 */
+	top = (char *) VMEM_1_BASE + (threadStackTop( thread->thread_slot ) << PAGESHIFT);
+	*(int *)(top - 4) = arg;
+	*(int *)(top - 8) = 0;
+	thread->user_context = *context;
+	thread->user_context.pc = func;
+	thread->user_context.sp = top - 8;
+
+	TracePrintf( 2, "[%d] Create thread %d\n", creator->id, thread->id );
+
+	switch ( cloneKernel( thread ) ){
+		case 0 : {
+			/* the thread starts at func */
+			*context = current_process->process->user_context;
+			return;
 		}
-		if ( list->next ){
-			list->next->prev = list->prev;
+		case ERROR : {
+			removeThreadFromProcess( creator->leader, thread );
+			freeProcess( thread );
+			free( list );
+			context->regs[ 0 ] = ERROR;
+			return;
 		}
-		
-		*tty_num = tty | TTY_WRITE;
+	}
 
-		/* keep track of the tty for this process */
-		list->obj = tty_num;
+	addToRunList( list );
 
-		addToIoList( list );
+	context->regs[ 0 ] = thread->id;
+}
 
-		current_process = skipIdle( save );
-		switchTo( old, current_process->process, context );
-		/* once we got here the tty interrupt fired */
-		
-		TracePrintf( 3, "[%d] wrote to terminal %d\n", process->id, tty );
+/* find a live thread with id 'id' that belongs to leader */
+static struct process * findThread( struct process * leader, int id ){
+	struct process * thread = leader->first_thread;
+	while ( thread != 0 && thread->id != id ){
+		thread = thread->next_thread;
+	}
+	return thread;
+}
 
-		terminal->busy = 0;
-	} else {
+/* wait for the thread 'id' in the same process to exit and get its exit status */
+static int handleThreadJoin( UserContext * context, int id, int * status ){
+	struct process * process = current_process->process;
+	struct process * leader = process->leader;
+
+	if ( status != 0 && ! ensureRegion1ReadWrite( status, sizeof( int ) ) ){
 		return ERROR;
 	}
 
-	return length;
-}
+	try_again:
+	/* the thread might have exited already */
+	{
+		struct status_list * previous = &leader->thread_exits;
+		while ( previous->next != 0 ){
+			struct status_list * exited = previous->next;
+			if ( exited->id == id ){
+				previous->next = exited->next;
+				if ( status != 0 ){
+					*status = exited->status;
+				}
+				free( exited );
+				return 0;
+			}
+			previous = exited;
+		}
+	}
 
-/* remove 'list' from the linked list it currently sits in and place it
- * in the list pointed to by head.
- * returns the node that immediately followed 'list' before removal
- * This is useful for taking the current process off the run queue,
- * putting it on some other queue and returning the next node on the run queue.
- */
- /*
-static struct process_list * putProcessOnList( struct process_list * head, struct process_list * list ){
-	struct process_list * save = list->next;
+	struct process * thread = findThread( leader, id );
+	/* only one thread can join another */
+	if ( thread == 0 || thread == process || thread->joiner != 0 ){
+		return ERROR;
+	}
+
+	TracePrintf( 4, "[%d] joining thread %d\n", process->id, id );
+	thread->joiner = process;
+
+	struct process_list * save = current_process->next;
+	struct process * old = current_process->process;
+	struct process_list * list = process->list;
 	if ( list->prev ){
 		list->prev->next = list->next;
 	}
@@ -763,140 +1120,1506 @@ static struct process_list * putProcessOnList( struct process_list * head, struc
 		list->next->prev = list->prev;
 	}
 
-	list->next = head->next;
-	list->prev = head;
-	if ( list->next ){
-		list->next->prev = list;
-	}
-	head->next = list;
-	return save;
-}
-*/
+	addToBusyList( list );
 
-/* find the process receiving with id 'id' */
-static struct process_list * findReceiver( int id ){
-	return findIpc( -1, -1, id );
-}
+	current_process = skipIdle( save );
+	switchTo( old, current_process->process, context );
+	/* the thread exited and left its status behind */
 
-/* find a process with id 'to' that only wants to receive from 'from' */
-static struct process_list * findReceiverSpecific( int from, int to ){
-	return findIpc( -1, from, to );
+	/* status may have been unmapped or shared while we slept */
+	if ( status != 0 && ! ensureRegion1ReadWrite( status, sizeof( int ) ) ){
+		return ERROR;
+	}
+	goto try_again;
 }
 
-/* find a process that wants to send to id 'id' */
-static struct process_list * findSender( int id, int from ){
-	return findIpc( id, from, -1 );
+/* end only the calling thread, the rest of the process keeps running */
+static void handleThreadExit( UserContext * context, int code ){
+	struct process_list * save = current_process->next;
+	endThread( current_process->process, code );
+	current_process = skipIdle( save );
+	switchTo( 0, current_process->process, context );
 }
 
-/* return the service, id/port pair, given the port */
-static struct service * findService( int port ){
-	int i = 0;
-	for ( i = 0; i < max_servers; i++ ){
-		if ( registered_servers[ i ].id != -1 &&
-		     registered_servers[ i ].port == port ){
-			return &registered_servers[ i ];
+/* returns 1 if child 'id' of process is still alive */
+static int isLiveChild( struct process * process, int id ){
+	struct process * child;
+	for ( child = process->first_child; child != 0; child = child->next_sibling ){
+		if ( child->id == id ){
+			return 1;
 		}
 	}
-
 	return 0;
 }
 
-/* return the pid for the service that registered the port
- * or -1 if there is no available service
+/* take the oldest status of child 'id', or of any child if id is -1, off
+ * the terminated list. returns 0 if there is none.
  */
-static int lookupService( int port ){
-	struct service * s = findService( port );
-	if ( s != 0 ){
-		return s->id;
-	} else {
-		return -1;
+static struct status_list * takeTerminated( struct process * process, int id ){
+	struct status_list * previous = &process->terminated;
+	while ( previous->next != 0 ){
+		struct status_list * list = previous->next;
+		if ( id == -1 || list->id == id ){
+			previous->next = list->next;
+			if ( process->last_terminated == list ){
+				process->last_terminated = previous;
+			}
+			return list;
+		}
+		previous = list;
 	}
+	return 0;
 }
 
-/* Send an ipc message to some other process.
- * This process tries to find a process on the ipc list waiting to
- * sent to. If it finds one then this process copies its message into
- * the receiving processes's inbox and then goes to sleep waiting for
- * a reply. If it does not find a process it goes to sleep waiting
- * for a process that does want to receive a message with a matching
- * id to wake this process up.
+/* wait for child 'pid' to die, or any child if pid is -1.
+ * returns 0 instead of blocking if flags has WAIT_NOHANG.
  */
-static int handleSend( UserContext * context, caddr_t message, int to ){
-	TracePrintf( 4, "[%d] Send a message %p to %d\n", current_process->process->id, message, to );
-
-	if ( ! ensureRegion1ReadWrite( message, IPC_MAX_LENGTH ) ){
+static int handleWaitPid( UserContext * context, struct process * process, int pid, int * status, int flags ){
+	if ( status != 0 && ! ensureRegion1ReadWrite( status, sizeof( int ) ) ){
+		return ERROR;
+	}
+
+	if ( pid < -1 || pid == 0 ){
+		return ERROR;
+	}
+
+	/* a goto here is more convenient than a while loop. if the process
+	 * goes to sleep because its waiting for a child to die then it will
+	 * jump back to here after being woken up. besides goto's make me
+	 * feel like I'm using tail recursion.
+	 */
+	try_again:
+	TracePrintf( 4, "[%d] waiting for dead child %d\n", process->id, pid );
+	/* see if any children have died so we can return one of them */
+	struct status_list * dead = takeTerminated( process, pid );
+	if ( dead != 0 ){
+		int id = dead->id;
+		addUsage( &process->child_usage, &dead->usage );
+		if ( status != 0 ){
+			*status = dead->status;
+		}
+		free( dead );
+		return id;
+	}
+
+	/* otherwise wait for a child to die */
+	if ( (pid == -1 && process->live_children > 0) ||
+	     (pid != -1 && isLiveChild( process, pid )) ){
+		if ( flags & WAIT_NOHANG ){
+			return 0;
+		}
+		/* dont run until a child has died */
+
+		struct process_list * save = current_process->next;
+		struct process * old = current_process->process;
+		struct process_list * list = process->list;
+		if ( list->prev ){
+			list->prev->next = list->next;
+		}
+		if ( list->next ){
+			list->next->prev = list->prev;
+		}
+
+		process->status = PROCESS_WAIT_FOR_DEAD_CHILD;
+		process->wait_for = pid;
+		addToBusyList( list );
+
+		current_process = skipIdle( save );
+		switchTo( old, current_process->process, context );
+		/* when the process comes back it will reap some children */
+		process->status = PROCESS_RUNNABLE;
+
+		if ( status != 0 && ! ensureRegion1ReadWrite( status, sizeof( int ) ) ){
+			return ERROR;
+		}
+
+		goto try_again;
+	}
+
+	TracePrintf( 2, "[%d] No children left\n", process->id );
+
+	return ERROR;
+}
+
+/* wait for any dead child */
+static int handleWait( UserContext * context, struct process * process, int * status ){
+	if ( ! ensureRegion1ReadWrite( status, sizeof( int ) ) ){
+		return ERROR;
+	}
+	return handleWaitPid( context, process, -1, status, 0 );
+}
+
+/* put process in the delay list and take it off of the run queue */
+static int handleDelay( struct process * process, int time ){
+	struct process_list * list = process->list;
+
+	if ( time == 0 ){
+		return 0;
+	}
+
+	if ( time < 0 ){
+		return ERROR;
+	}
+
+	int * delay = (int *) malloc( sizeof( int ) );
+
+	if ( ! delay ){
+		return ERROR;
+	}
+
+	if ( list->prev ){
+		list->prev->next = list->next;
+	}
+	if ( list->next ){
+		list->next->prev = list->prev;
+	}
+
+	*delay = time;
+	list->obj = delay;
+
+	addToDelayedList( list );
+
+	TracePrintf( 4, "[%d] Delay for %d ticks\n", process->id, time );
+
+	return 1;
+}
+
+/* take process off the run list and put it on the io list until a terminal
+ * trap wakes it up. 'what' is the tty or'd with TTY_READ, TTY_WRITE or
+ * TTY_WAIT and is what the trap looks for.
+ */
+static int waitForTty( UserContext * context, struct process * process, int what ){
+	int * tty_num = (int *) malloc( sizeof(int) );
+	if ( ! tty_num ){
+		return ERROR;
+	}
+	*tty_num = what;
+
+	struct process_list * save = current_process->next;
+	struct process * old = current_process->process;
+
+	struct process_list * list = process->list;
+	if ( list->prev ){
+		list->prev->next = list->next;
+	}
+	if ( list->next ){
+		list->next->prev = list->prev;
+	}
+
+	/* keep track of the tty for this process */
+	list->obj = tty_num;
+
+	addToIoList( list );
+
+	current_process = skipIdle( save );
+	switchTo( old, current_process->process, context );
+	return 0;
+}
+
+/* move the first process waiting to read from tty off the io list to
+ * right after the current process. returns 1 if there was one.
+ */
+static int wakeTtyReader( int tty ){
+	struct process_list * list = findIOProcess( tty | TTY_READ );
+	if ( list == 0 ){
+		return 0;
+	}
+
+	list->prev->next = list->next;
+	if ( list->next ){
+		list->next->prev = list->prev;
+	}
+	free( list->obj );
+	list->obj = 0;
+	list->next = current_process->next;
+	list->prev = current_process;
+	current_process->next->prev = list;
+	current_process->next = list;
+	return 1;
+}
+
+/* append a received line to the input ring of a terminal. returns how
+ * many bytes fit, the rest of the line is lost.
+ */
+static int queueInput( struct tty * terminal, char * data, int length ){
+	int total = 0;
+	while ( total < length && terminal->input_count < TTY_INPUT_SIZE ){
+		int end = (terminal->input_start + terminal->input_count) % TTY_INPUT_SIZE;
+		int chunk = end >= terminal->input_start ? TTY_INPUT_SIZE - end : terminal->input_start - end;
+		if ( chunk > length - total ){
+			chunk = length - total;
+		}
+		memcpy( terminal->input + end, data + total, chunk );
+		terminal->input_count += chunk;
+		total += chunk;
+	}
+	return total;
+}
+
+/* move up to length bytes of input into buffer, stopping after the first
+ * newline so one read gets at most one line. whatever is left stays in
+ * the ring for the next read.
+ */
+static int copyFromTty( struct tty * terminal, char * buffer, int length ){
+	int read = 0;
+	while ( read < length && terminal->input_count > 0 ){
+		/* the unread bytes may wrap around the end of the ring */
+		char * start = terminal->input + terminal->input_start;
+		char * newline;
+		int chunk = TTY_INPUT_SIZE - terminal->input_start;
+		if ( chunk > terminal->input_count ){
+			chunk = terminal->input_count;
+		}
+		if ( chunk > length - read ){
+			chunk = length - read;
+		}
+		newline = (char *) memchr( start, '\n', chunk );
+		if ( newline ){
+			chunk = newline - start + 1;
+		}
+		memcpy( buffer + read, start, chunk );
+		terminal->input_start = (terminal->input_start + chunk) % TTY_INPUT_SIZE;
+		terminal->input_count -= chunk;
+		read += chunk;
+		if ( newline ){
+			break;
+		}
+	}
+	return read;
+}
+
+/* read a line from a terminal. this process sleeps until something
+ * has been typed.
+ */
+static int handleTtyRead( UserContext * context, struct process * process, int tty, void * buffer, int length ){
+	struct tty * terminal;
+	int read;
+
+	if ( tty < 0 || tty >= NUM_TERMINALS ){
+		return ERROR;
+	}
+	if ( ! ensureRegion1ReadWrite( buffer, length ) ){
+		return ERROR;
+	}
+
+	terminal = &terminals[ tty ];
+	while ( terminal->input_count == 0 ){
+		if ( waitForTty( context, process, tty | TTY_READ ) == ERROR ){
+			return ERROR;
+		}
+	}
+
+	/* the buffer may have been unmapped or shared while we slept */
+	if ( ! ensureRegion1ReadWrite( buffer, length ) ){
+		return ERROR;
+	}
+
+	read = copyFromTty( terminal, (char *) buffer, length );
+
+	/* lines are still queued, let the next reader have them */
+	if ( terminal->input_count > 0 ){
+		wakeTtyReader( tty );
+	}
+	return read;
+}
+
+/* give the hardware the next piece of queued output unless it is still
+ * sending one. the piece stays in the ring until the transmit trap says
+ * it is gone.
+ */
+static void startTransmit( int tty ){
+	struct tty * terminal = &terminals[ tty ];
+	int length = terminal->output_count;
+
+	if ( terminal->transmitting || length == 0 ){
+		return;
+	}
+	if ( length > TTY_OUTPUT_SIZE - terminal->output_start ){
+		length = TTY_OUTPUT_SIZE - terminal->output_start;
+	}
+	if ( length > TERMINAL_MAX_LINE ){
+		length = TERMINAL_MAX_LINE;
+	}
+	terminal->transmitting = length;
+	TtyTransmit( tty, terminal->output + terminal->output_start, length );
+}
+
+/* append data to the output ring of a terminal. the caller made room */
+static void queueOutput( struct tty * terminal, char * data, int length ){
+	while ( length > 0 ){
+		int end = (terminal->output_start + terminal->output_count) % TTY_OUTPUT_SIZE;
+		int chunk = TTY_OUTPUT_SIZE - end;
+		if ( chunk > length ){
+			chunk = length;
+		}
+		memcpy( terminal->output + end, data, chunk );
+		terminal->output_count += chunk;
+		data += chunk;
+		length -= chunk;
+	}
+}
+
+/* 1 if some terminal still has output to send */
+int terminalsTransmitting(){
+	int tty;
+	for ( tty = 0; tty < NUM_TERMINALS; tty++ ){
+		if ( terminals[ tty ].transmitting ){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* a process wants to write into a tty. the bytes are queued in the
+ * terminal's output ring and the write returns once all of them are in it,
+ * the transmit trap sends them out. a process only waits while the ring has
+ * no room. a write of any length is queued in pieces of up to
+ * TERMINAL_MAX_LINE bytes and each piece goes in whole, so lines of
+ * different processes don't get mixed up.
+ */
+static int handleTtyWrite( UserContext * context, struct process * process, int tty, void * buffer, int length ){
+	int written = 0;
+	if ( ! ensureRegion1Read( buffer, length ) ){
+		return ERROR;
+	}
+	if ( length == 0 ){
+		return ERROR;
+	}
+	if ( tty >= 0 && tty < NUM_TERMINALS ){
+		struct tty * terminal = &terminals[ tty ];
+
+		while ( written < length ){
+			int piece = length - written;
+			if ( piece > TERMINAL_MAX_LINE ){
+				piece = TERMINAL_MAX_LINE;
+			}
+
+			if ( TTY_OUTPUT_SIZE - terminal->output_count < piece ){
+				TracePrintf( 4, "[%d] waiting for room in tty %d\n", process->id, tty );
+				if ( waitForTty( context, process, tty | TTY_WAIT | TTY_WRITE ) == ERROR ){
+					return written > 0 ? written : ERROR;
+				}
+				/* a thread may have given the memory back meanwhile */
+				if ( ! ensureRegion1Read( (char *) buffer + written, length - written ) ){
+					return written > 0 ? written : ERROR;
+				}
+				continue;
+			}
+
+			TracePrintf( 3, "[%d] writing %d bytes to terminal %d\n", process->id, piece, tty );
+			queueOutput( terminal, (char *) buffer + written, piece );
+			startTransmit( tty );
+			written += piece;
+		}
+	} else {
+		return ERROR;
+	}
+
+	return written;
+}
+
+/* remove 'list' from the linked list it currently sits in and place it
+ * in the list pointed to by head.
+ * returns the node that immediately followed 'list' before removal
+ * This is useful for taking the current process off the run queue,
+ * putting it on some other queue and returning the next node on the run queue.
+ */
+ /*
+static struct process_list * putProcessOnList( struct process_list * head, struct process_list * list ){
+	struct process_list * save = list->next;
+	if ( list->prev ){
+		list->prev->next = list->next;
+	}
+	if ( list->next ){
+		list->next->prev = list->prev;
+	}
+
+	list->next = head->next;
+	list->prev = head;
+	if ( list->next ){
+		list->next->prev = list;
+	}
+	head->next = list;
+	return save;
+}
+*/
+
+/* threads receive and reply on behalf of their leader, so a server
+ * with several threads is still a single ipc endpoint. messages are
+ * sent and replies received by the thread itself.
+ */
+static int ipcId( struct process * process ){
+	return process->leader->id;
+}
+
+/* find the process receiving with id 'id' */
+static struct process_list * findReceiver( int id ){
+	return findIpc( -1, -1, id );
+}
+
+/* find a process with id 'to' that only wants to receive from 'from' */
+static struct process_list * findReceiverSpecific( int from, int to ){
+	return findIpc( -1, from, to );
+}
+
+/* find a process that wants to send to id 'id' */
+static struct process_list * findSender( int id, int from ){
+	return findIpc( id, from, -1 );
+}
+
+/* return the service, id/port pair, given the port */
+static struct service * findService( int port ){
+	int i = 0;
+	for ( i = 0; i < max_servers; i++ ){
+		if ( registered_servers[ i ].id != -1 &&
+		     registered_servers[ i ].port == port ){
+			return &registered_servers[ i ];
+		}
+	}
+
+	return 0;
+}
+
+/* return the worker on port that has served the fewest messages. with
+ * idle set only workers blocked in Receive that take a message from 'from'
+ * count. returns 0 if there is no such worker.
+ */
+static struct service * pickService( int port, int idle, int from ){
+	struct service * best = 0;
+	int i;
+	for ( i = 0; i < max_servers; i++ ){
+		struct service * s = &registered_servers[ i ];
+		if ( s->id == -1 || s->port != port ){
+			continue;
+		}
+		if ( idle && findWaitingReceiver( s->id, from ) == 0 ){
+			continue;
+		}
+		if ( best == 0 || s->served < best->served ){
+			best = s;
+		}
+	}
+	return best;
+}
+
+/* the counters of a port. with 'create' they are made if the port has
+ * none yet. returns 0 if there are none or no memory.
+ */
+static struct ipc_stats * findPortStats( int port, int create ){
+	struct port_stats * more;
+	int i;
+	for ( i = 0; i < max_port_stats; i++ ){
+		if ( port_stats[ i ].port == port ){
+			return &port_stats[ i ].stats;
+		}
+	}
+	if ( ! create ){
+		return 0;
+	}
+
+	more = (struct port_stats *) realloc( port_stats, sizeof( struct port_stats ) * (max_port_stats + 1) );
+	if ( ! more ){
+		return 0;
+	}
+	port_stats = more;
+	port_stats[ max_port_stats ].port = port;
+	bzero( &port_stats[ max_port_stats ].stats, sizeof( struct ipc_stats ) );
+	max_port_stats += 1;
+	return &port_stats[ max_port_stats - 1 ].stats;
+}
+
+/* histogram bucket of a wait of 'time' microseconds */
+static int latencyBucket( unsigned long long time ){
+	int bucket = 0;
+	while ( bucket < IPC_HISTOGRAM_BUCKETS - 1 && time >= (1ULL << bucket) ){
+		bucket += 1;
+	}
+	return bucket;
+}
+
+/* count a Send that waited for a receiver and then for the reply */
+static void recordSend( struct ipc_stats * stats, unsigned long long receiver_wait, unsigned long long reply_wait ){
+	stats->sends += 1;
+	stats->receiver_wait += receiver_wait;
+	stats->reply_wait += reply_wait;
+	stats->receiver_histogram[ latencyBucket( receiver_wait ) ] += 1;
+	stats->reply_histogram[ latencyBucket( reply_wait ) ] += 1;
+}
+
+/* count bytes the current process copied for the request of 'client' */
+static void recordCopy( struct process_list * client, int bytes ){
+	struct ipc * obj = (struct ipc *) client->obj;
+	struct ipc_stats * stats;
+	current_process->process->leader->ipc_stats.bytes_copied += bytes;
+	if ( obj->service && (stats = findPortStats( obj->service, 0 )) != 0 ){
+		stats->bytes_copied += bytes;
+	}
+}
+
+/* return the pid of the least busy worker for the port
+ * or -1 if there is no available service
+ */
+static int lookupService( int port ){
+	struct service * s = pickService( port, 0, -1 );
+	if ( s != 0 ){
+		s->served += 1;
+		return s->id;
+	} else {
+		return -1;
+	}
+}
+
+/* a worker is about to receive, so let the oldest sender waiting on each of
+ * its ports try again. returns 1 if any sender was woken up.
+ */
+static int wakeupPortSenders( int id ){
+	int woke = 0;
+	int i;
+	for ( i = 0; i < max_servers; i++ ){
+		if ( registered_servers[ i ].id == id ){
+			struct process_list * sender = findPortSender( registered_servers[ i ].port );
+			if ( sender ){
+				((struct ipc *) sender->obj)->port = 0;
+				wakeupParent( sender->process );
+				woke = 1;
+			}
+		}
+	}
+	return woke;
+}
+
+/* Send an ipc message to some other process.
+ * This process tries to find a process on the ipc list waiting to
+ * sent to. If it finds one then this process copies its message into
+ * the receiving processes's inbox and then goes to sleep waiting for
+ * a reply. If it does not find a process it goes to sleep waiting
+ * for a process that does want to receive a message with a matching
+ * id to wake this process up.
+ */
+static int handleSend( UserContext * context, caddr_t message, int to ){
+	TracePrintf( 4, "[%d] Send a message %p to %d\n", current_process->process->id, message, to );
+
+	if ( ! ensureRegion1ReadWrite( message, IPC_MAX_LENGTH ) ){
+		return ERROR;
+	}
+
+	/* a message to a port goes to whichever of its workers is free first */
+	int port = 0;
+	if ( to < 0 ){
+		port = -to;
+		if ( ! findService( port ) ){
+			TracePrintf( 4, "[%d] No server registered on port %d\n", current_process->process->id, port );
+			return ERROR;
+		}
+	} else {
+		/* a message to a thread goes to its process */
+		struct process * receiver_process = findProcess( to );
+		if ( receiver_process ){
+			to = ipcId( receiver_process );
+		}
+	}
+
+	struct ipc * obj = (struct ipc *) malloc( sizeof(struct ipc) );
+	if ( ! obj ){
+		return ERROR;
+	}
+	obj->service = 0;
+
+	/* the port's counters are made now so a Send that fails for lack
+	 * of memory does not get half counted later
+	 */
+	if ( port ){
+		findPortStats( port, 1 );
+	}
+	unsigned long long start = now();
+
+	int sent = 0;
+	while ( ! sent ){
+		struct process_list * receiver = 0;
+		if ( port ){
+			struct service * worker = pickService( port, 1, current_process->process->id );
+			if ( worker ){
+				worker->served += 1;
+				to = worker->id;
+				receiver = findWaitingReceiver( to, current_process->process->id );
+			} else if ( ! findService( port ) ){
+				TracePrintf( 4, "[%d] Workers on port %d are gone\n", current_process->process->id, port );
+				free( obj );
+				current_process->obj = 0;
+				return ERROR;
+			}
+		} else {
+			receiver = findReceiver( to );
+		}
+		TracePrintf( 5, "[%d] trying to send ipc message to %d\n", current_process->process->id, to );
+		if ( receiver ){
+			memcpy( receiver->process->inbox, message, IPC_MAX_LENGTH );
+			sent = 1;
+			stopTimer( receiver->process );
+
+			struct ipc * obj = (struct ipc *) receiver->obj;
+			obj->from = current_process->process->id;
+			/* wake the receiver up */
+			// free( receiver->obj );
+			if ( receiver->prev ){
+				receiver->prev->next = receiver->next;
+			}
+			if ( receiver->next ){
+				receiver->next->prev = receiver->prev;
+			}
+			receiver->next = current_process->next;
+			receiver->prev = current_process;
+			current_process->next->prev = receiver;
+			current_process->next = receiver;
+		} else {
+			/* goto sleep. a port sender waits for any worker */
+			obj->from = current_process->process->id;
+			obj->to = port ? -1 : to;
+			obj->receive = -1;
+			obj->reply = 0;
+			obj->port = port;
+			current_process->obj = obj;
+			if ( port ){
+				int i;
+				for ( i = 0; i < max_servers; i++ ){
+					if ( registered_servers[ i ].id != -1 && registered_servers[ i ].port == port ){
+						wakeSelectors( registered_servers[ i ].id, SELECT_MESSAGE );
+					}
+				}
+			} else {
+				wakeSelectors( to, SELECT_MESSAGE );
+			}
+			struct process_list * save = current_process->next;
+			struct process * old = current_process->process;
+			if ( current_process->prev ){
+				current_process->prev->next = current_process->next;
+			}
+			if ( current_process->next ){
+				current_process->next->prev = current_process->prev;
+			}
+
+			addToIpcList( current_process );
+
+			current_process = skipIdle( save );
+			switchTo( old, current_process->process, context );
+		}
+	}
+
+	/* the message has been sent so now go back to sleep until a reply
+	 * has been sent
+	 */
+	unsigned long long received = now();
+
+	obj->receive = current_process->process->id;
+	obj->to = -1;
+	obj->reply = 1;
+	obj->port = 0;
+	obj->service = port;
+	/* not explicitly mentioned in the docs but this process should only
+	 * get the reply from the process it just sent to.
+	 */
+	obj->from = to;
+	current_process->obj = obj;
+
+	struct process_list * save = current_process->next;
+	struct process * old = current_process->process;
+	if ( current_process->prev ){
+		current_process->prev->next = current_process->next;
+	}
+	if ( current_process->next ){
+		current_process->next->prev = current_process->prev;
+	}
+	addToIpcList( current_process );
+	// current_process = skipIdle( putProcessOnList( &ipc_list, current_process ) );
+	current_process = skipIdle( save );
+
+	switchTo( old, current_process->process, context );
+	/* the receiver may have shared its pages into ours with CopyTo */
+	if ( ! ensureRegion1ReadWrite( message, IPC_MAX_LENGTH ) ){
+		free( obj );
+		current_process->obj = 0;
+		return ERROR;
+	}
+	memcpy( message, current_process->process->inbox, IPC_MAX_LENGTH );
+	free( obj );
+	current_process->obj = 0;
+	current_process->process->usage.messages += 1;
+
+	unsigned long long replied = now();
+	recordSend( &current_process->process->leader->ipc_stats, received - start, replied - received );
+	if ( port ){
+		struct ipc_stats * stats = findPortStats( port, 0 );
+		if ( stats ){
+			recordSend( stats, received - start, replied - received );
+		}
+	}
+
+	return 0;
+}
+
+/* give receiver a message from 'from' without blocking. a receiver that is
+ * waiting in Receive gets it right away, otherwise it goes in the mailbox.
+ * returns 0 or -1 if the mailbox is full.
+ */
+static int deliverMessage( struct process * receiver, int from, caddr_t message ){
+	struct process_list * list = findWaitingReceiver( receiver->id, from );
+	if ( list ){
+		struct ipc * obj = (struct ipc *) list->obj;
+		memcpy( list->process->inbox, message, IPC_MAX_LENGTH );
+		obj->from = from;
+		stopTimer( list->process );
+		wakeupParent( list->process );
+		return 0;
+	}
+	if ( putMail( receiver, from, message ) != 0 ){
+		return -1;
+	}
+	wakeSelectors( receiver->id, SELECT_MESSAGE );
+	return 0;
+}
+
+/* send a message without waiting for the receiver. a receiver that is
+ * blocked in Receive gets it right away, otherwise it is queued in the
+ * receiver's mailbox where the next Receive finds it. there is no reply.
+ */
+static int handleSendAsync( caddr_t message, int to ){
+	struct process * sender = current_process->process;
+	struct process * receiver;
+
+	if ( ! ensureRegion1Read( message, IPC_MAX_LENGTH ) ){
 		return ERROR;
 	}
 
 	if ( to < 0 ){
-		int port = -to;
-		to = lookupService( port );
-		if ( to == -1 ){
-			TracePrintf( 4, "[%d] No server registered on port %d\n", current_process->process->id, port );
+		to = lookupService( -to );
+	}
+	receiver = findProcess( to );
+	if ( ! receiver || receiver->status == PROCESS_DIED ){
+		return ERROR;
+	}
+	receiver = receiver->leader;
+
+	if ( deliverMessage( receiver, sender->id, message ) != 0 ){
+		return ERROR;
+	}
+
+	sender->usage.messages += 1;
+	return 0;
+}
+
+/* make a group with the caller in it and store its handle in id */
+static int handleGroupCreate( int * id ){
+	int handle;
+	if ( ! ensureRegion1ReadWrite( id, sizeof( int ) ) ){
+		return ERROR;
+	}
+	handle = createGroup();
+	if ( handle == ERROR ){
+		return ERROR;
+	}
+	joinGroup( handle, current_process->process->leader->id );
+	*id = handle;
+	return 0;
+}
+
+/* put message in the mailbox of every member of a group but the caller,
+ * or hand it to members waiting in Receive. nobody is waited for.
+ * returns how many members got it, members with a full mailbox miss it.
+ */
+static int handleGroupNotify( caddr_t message, int handle ){
+	struct process * sender = current_process->process;
+	struct group * group = findGroup( handle );
+	int delivered = 0;
+	int i;
+
+	if ( ! group || ! ensureRegion1Read( message, IPC_MAX_LENGTH ) ){
+		return ERROR;
+	}
+
+	for ( i = 0; i < group->count; i++ ){
+		struct process * receiver;
+		if ( group->members[ i ] == sender->leader->id ){
+			continue;
+		}
+		receiver = findProcess( group->members[ i ] );
+		if ( ! receiver || receiver->status == PROCESS_DIED ){
+			continue;
+		}
+		if ( deliverMessage( receiver->leader, sender->id, message ) == 0 ){
+			delivered += 1;
+		} else {
+			TracePrintf( 3, "[%d] Mailbox of %d is full, group %d notification dropped\n", sender->id, receiver->id, handle );
+		}
+	}
+
+	sender->usage.messages += 1;
+	return delivered;
+}
+
+/* hand the request of 'from', which is waiting for a reply from this
+ * process, to 'to' as if 'from' had sent message there. the reply, and the
+ * right to CopyFrom and CopyTo the client, now belong to 'to'.
+ */
+static int handleForward( caddr_t message, int to, int from ){
+	struct process * forwarder = current_process->process;
+	struct process_list * client;
+	struct process * receiver;
+
+	if ( ! ensureRegion1Read( message, IPC_MAX_LENGTH ) ){
+		return ERROR;
+	}
+
+	client = findReceiverSpecific( ipcId( forwarder ), from );
+	if ( ! client || ! ((struct ipc *) client->obj)->reply ){
+		TracePrintf( 4, "[%d] %d is not waiting for a reply to forward\n", forwarder->id, from );
+		return ERROR;
+	}
+
+	if ( to < 0 ){
+		to = lookupService( -to );
+	}
+	receiver = findProcess( to );
+	if ( ! receiver || receiver->status == PROCESS_DIED ){
+		return ERROR;
+	}
+	receiver = receiver->leader;
+	if ( receiver == client->process->leader ){
+		return ERROR;
+	}
+
+	if ( deliverMessage( receiver, from, message ) != 0 ){
+		return ERROR;
+	}
+	((struct ipc *) client->obj)->from = receiver->id;
+
+	TracePrintf( 4, "[%d] Forwarded request of %d to %d\n", forwarder->id, from, receiver->id );
+	forwarder->usage.messages += 1;
+	return 0;
+}
+
+/* returns 1 if a sender was woken up */
+static int wakeupSenders( int to, int from ){
+	struct process_list * sender = findSender( to, from );
+	if ( sender ){
+		if ( sender->prev ){
+			sender->prev->next = sender->next;
+		}
+		if ( sender->next ){
+			sender->next->prev = sender->prev;
+		}
+		sender->next = current_process->next;
+		sender->prev = current_process;
+		current_process->next->prev = sender;
+		current_process->next = sender;
+		TracePrintf( 5, "[%d] Woke up %p %d\n", current_process->process->id, sender->process, sender->process->id );
+		return 1;
+	}
+	return 0;
+}
+
+/* receive an ipc message.
+ * First wake up a process that might be trying to send to this process.
+ * Then this process adds itself to the ipc list waiting for the sender to
+ * push his message out. The sender will wake this process back up and
+ * finally the sender's pid is returned.
+ *
+ * If from is -1 then any process can send to this one. If it is some positive
+ * number then only the process with id 'from' can send to it.
+ *
+ * ticks limits how long to wait, -1 is forever. 0 is returned when nothing
+ * came in time. with 0 ticks the process only sleeps if a sender is already
+ * waiting, which then runs before any clock tick and hands its message over.
+ */
+static int handleReceive( UserContext * context, char * buffer, int from, int ticks ){
+	
+	if ( ! ensureRegion1ReadWrite( buffer, IPC_MAX_LENGTH ) ){
+		return ERROR;
+	}
+
+	/* queued asynchronous messages are taken without blocking */
+	int sender = takeMail( current_process->process->leader, from, buffer );
+	if ( sender != -1 ){
+		current_process->process->usage.messages += 1;
+		current_process->process->leader->ipc_stats.receives += 1;
+		return sender;
+	}
+
+	struct ipc * obj = (struct ipc *) malloc( sizeof( struct ipc ) );
+	if ( ! obj ){
+		return ERROR;
+	}
+
+	obj->receive = ipcId( current_process->process );
+	obj->to = -1;
+	obj->from = from;
+	obj->reply = 0;
+	obj->port = 0;
+	obj->service = 0;
+
+	current_process->obj = obj;
+
+	/* wake up any processes that want to send to this process */
+	int woke = wakeupSenders( ipcId( current_process->process ), from );
+	if ( from == -1 ){
+		woke |= wakeupPortSenders( ipcId( current_process->process ) );
+	}
+
+	if ( ticks == 0 ){
+		if ( ! woke ){
+			free( obj );
+			current_process->obj = 0;
+			return 0;
+		}
+		ticks = 1;
+	}
+	if ( ticks > 0 ){
+		startTimer( current_process->process, ticks );
+	}
+
+	/* put self in the ipc list and goto sleep. the sender will
+	 * wake this process back up.
+	 */
+	struct process_list * save = current_process->next;
+	struct process * old = current_process->process;
+	if ( current_process->prev ){
+		current_process->prev->next = current_process->next;
+	}
+	if ( current_process->next ){
+		current_process->next->prev = current_process->prev;
+	}
+
+	addToIpcList( current_process );
+
+	current_process = skipIdle( save );
+	TracePrintf( 5, "[%d] waiting to receive\n", old->id );
+	switchTo( old, current_process->process, context );
+
+	obj = (struct ipc *) current_process->obj;
+	if ( current_process->process->timed_out ){
+		current_process->process->timed_out = 0;
+		free( obj );
+		current_process->obj = 0;
+		return 0;
+	}
+
+	/* a thread of ours may have had the page shared while we slept */
+	if ( ! ensureRegion1ReadWrite( buffer, IPC_MAX_LENGTH ) ){
+		free( obj );
+		current_process->obj = 0;
+		return ERROR;
+	}
+	memcpy( buffer, current_process->process->inbox, IPC_MAX_LENGTH );
+
+	int id = obj->from;
+	free( obj );
+	current_process->obj = 0;
+	current_process->process->usage.messages += 1;
+	current_process->process->leader->ipc_stats.receives += 1;
+
+	return id;
+}
+
+/* send an ipc message back to some process.
+ * if there is no process waiting for a reply then return ERROR.
+ * otherwise copy the message to that process's inbox and put
+ * the process back on the run queue.
+ */
+static int handleReply( char * message, int to ){
+	if ( ! ensureRegion1Read( message, IPC_MAX_LENGTH ) ){
+		return ERROR;
+	}
+
+	struct process_list * list = findReceiverSpecific( ipcId( current_process->process ), to );
+	if ( ! list ){
+		/* no one is waiting for a reply */
+		return -1;
+	} else {
+		if ( list->prev ){
+			list->prev->next = list->next;
+		}
+		if ( list->next ){
+			list->next->prev = list->prev;
+		}
+		list->next = current_process->next;
+		list->prev = current_process;
+		current_process->next->prev = list;
+		current_process->next = list;
+
+		memcpy( list->process->inbox, message, IPC_MAX_LENGTH );
+		current_process->process->leader->ipc_stats.replies += 1;
+	}
+
+	return 0;
+}
+
+/* reply to 'to' and wait for the next message in the same buffer, which
+ * is what a server does for every request. the replied to process was
+ * put right after this one on the run list, so it gets the cpu as soon
+ * as the server blocks. a reply to a process that gave up waiting is
+ * dropped like the servers drop a failed Reply.
+ */
+static int handleReplyAndReceive( UserContext * context, char * message, int to ){
+	/* don't block in Receive if the caller has to hear about the reply */
+	if ( handleReply( message, to ) != 0 ){
+		TracePrintf( 4, "[%d] %d is not waiting for a reply\n", current_process->process->id, to );
+		return ERROR;
+	}
+	return handleReceive( context, message, -1, -1 );
+}
+
+/* register a service on a given port. processes that register the same
+ * port become a pool and Send to the port picks one of them.
+ */
+static int handleRegister( unsigned int port ){
+	int id = ipcId( current_process->process );
+	int i;
+	for ( i = 0; i < max_servers; i++ ){
+		if ( registered_servers[ i ].id == id && registered_servers[ i ].port == port ){
+			return ERROR;
+		}
+	}
+
+	if ( ! registered_servers ){
+		max_servers = 4;
+		registered_servers = (struct service *) malloc( sizeof( struct service ) * max_servers );
+		if ( ! registered_servers ){
+			return ERROR;
+		}
+		for ( i = 0; i < max_servers; i++ ){
+			registered_servers[i] = (struct service){ .port = 0, .id = -1, .served = 0 };
+		}
+	}
+
+	int index = 0;
+	for ( index = 0; index < max_servers && registered_servers[ index ].id != -1; index++ ){
+	}
+
+	/* grow the servers list */
+	if ( index == max_servers ){
+		int new_max = max_servers * 2;
+		struct service * new_servers = (struct service *) malloc( sizeof( struct service ) * new_max );
+		if ( ! new_servers ){
+			return ERROR;
+		}
+		for ( i = max_servers; i < new_max; i++ ){
+			new_servers[i] = (struct service){ .port = 0, .id = -1, .served = 0 };
+		}
+		memcpy( new_servers, registered_servers, sizeof( struct service ) * max_servers );
+		free( registered_servers );
+		registered_servers = new_servers;
+		max_servers = new_max;
+	}
+
+	registered_servers[ index ] = (struct service){ .port = port, .id = id, .served = 0 };
+	return 0;
+}
+
+/* copy bytes from source_process to dest_process.
+ * This function doesn't care if either process is currently mapped in,
+ * it will map each frame that needs to be copied to some unused virtual
+ * page in region 0 and copy the bytes from there.
+ *
+ * All the src_/dest_ variables are for when the addresses don't align
+ * within their respective pages. e.g:
+ * dest = 0x5140
+ * src = 0xe523
+ * And assume there is a page boundary at 0x5000, 0x6000, 0xe000, 0xf000.
+ * Then there are less bytes from 0xf000 - src than there are in
+ * 0x6000 - dest.
+ */
+static int copyBytes( struct process * dest_process, struct process * source_process, caddr_t dest, caddr_t src, int length, int dest_virtual, int src_virtual ){
+	/* the frames are written through region 0 so shared ones have to be split first */
+	if ( unshareRange( dest_process->page_table, dest, length ) == -1 ){
+		return ERROR;
+	}
+
+	/* current page in process space for each process */
+	int dest_page = to_page( (unsigned long) dest, 0 ) - to_page( VMEM_1_BASE, 0 );
+	int src_page = to_page( (unsigned long) src, 0 ) - to_page( VMEM_1_BASE, 0 );
+		
+	/* max bytes that can be copied from this page */
+	int dest_max = length > (unsigned long)UP_TO_PAGE( dest + 1 ) - (long)dest ? (unsigned long)UP_TO_PAGE( dest + 1 ) - (long)dest : length;
+	/* starting address within the page */
+	int dest_begin = (unsigned long) dest - (unsigned long) DOWN_TO_PAGE( dest );
+
+	int source_max = length > (unsigned long) UP_TO_PAGE( src + 1 ) - (unsigned long) src ? (unsigned long) UP_TO_PAGE( src + 1 ) - (unsigned long) src : length;
+	int source_begin = (unsigned long) src - (unsigned long) DOWN_TO_PAGE( src );
+		
+	/* map the same physical frame being used by the process to the region 0 page */		
+	mapUnusedPage0( dest_process->page_table[ dest_page ]->frame, dest_virtual );
+	mapUnusedPage0( source_process->page_table[ src_page ]->frame, src_virtual );
+
+	TracePrintf( 7, "Map dest virtual %d to physical %d\n", dest_virtual, dest_page );
+	TracePrintf( 7, "Map src virtual %d to physical %d\n", src_virtual, src_page );
+
+	while ( length > 0 ){
+		/* copy the fewest allowed bytes */
+		int min = dest_max < source_max ? dest_max : source_max;
+
+		unsigned long dest_addr = (dest_virtual << PAGESHIFT) + dest_begin;
+		unsigned long src_addr = (src_virtual << PAGESHIFT) + source_begin;
+
+		length -= min;
+		TracePrintf( 7, "Copy %d bytes from %p to %p. Remaining %d\n", min, src_addr, dest_addr, length );
+
+		memcpy( (void *) dest_addr, (void *) src_addr, min );
+
+		if ( length == 0 ){
+			break;
+		}
+
+		dest_max -= min;
+		source_max -= min;
+		dest_begin += min;
+		source_begin += min;
+		TracePrintf( 7, "Dest page %d max %d dest begin %d\n", dest_page, dest_max, dest_begin );
+		TracePrintf( 7, "Src page %d max %d src begin %d\n", src_page, source_max, source_begin );
+		/* if dest ran out of bytes to copy then find the next page */
+		if ( dest_max == 0 ){
+			dest_page += 1;
+			dest_begin = 0;
+			dest_max = length < PAGESIZE ? length : PAGESIZE;
+			mapUnusedPage0( dest_process->page_table[ dest_page ]->frame, dest_virtual );
+		}
+
+		/* same for src */
+		if ( source_max == 0 ){
+			src_page += 1;
+			source_begin = 0;
+			source_max = length < PAGESIZE ? length : PAGESIZE;
+			mapUnusedPage0( source_process->page_table[ src_page ]->frame, src_virtual );
+		}
+	}
+
+	return 0;
+}
+
+/* map two unused region 0 pages for copyBytes to copy through.
+ * returns 0 or ERROR if region 0 is full.
+ */
+static int reserveCopyWindows( int * dest_virtual, int * src_virtual ){
+	*dest_virtual = findUnusedPage0();
+	if ( *dest_virtual == -1 ){
+		return ERROR;
+	}
+	TracePrintf( 8, "Dest virtual %d\n", *dest_virtual );
+	mapUnusedPage0( 0, *dest_virtual );
+	*src_virtual = findUnusedPage0();
+	if ( *src_virtual == -1 ){
+		unMapPage0( *dest_virtual );
+		return ERROR;
+	}
+	TracePrintf( 8, "Src virtual %d\n", *src_virtual );
+	mapUnusedPage0( 0, *src_virtual );
+	return 0;
+}
+
+/* dont leave bogus pages mapped into region 0 */
+static void releaseCopyWindows( int dest_virtual, int src_virtual ){
+	unMapPage0( dest_virtual );
+	unMapPage0( src_virtual );
+}
+
+/* 1 if src can be read from source_process and dest written in dest_process */
+static int checkCopy( struct process * dest_process, struct process * source_process, caddr_t dest, caddr_t src, int length ){
+	if ( ! ensureReadInTable( source_process->page_table, src, length ) ){
+		TracePrintf( 6, "[kernel] %p is not a valid address in the source process\n", src );
+		return 0;
+	}
+
+	if ( ! ensureReadWriteInTable( dest_process->page_table, dest, length ) ){
+		TracePrintf( 6, "[kernel] %p is not a valid address in the destination process\n", dest );
+		return 0;
+	}
+	return 1;
+}
+
+/* copy checked memory from source_process to dest_process.
+ * When dest and src sit at the same offset within their pages the pages
+ * that are covered completely aren't copied at all. The destination maps
+ * the source frame instead and both sides are copy on write, so only the
+ * partial pages at either end cost a memcpy.
+ */
+static int copyPages( struct process * dest_process, struct process * source_process, caddr_t dest, caddr_t src, int length, int dest_virtual, int src_virtual ){
+	if ( ((unsigned long) dest - (unsigned long) src) % PAGESIZE != 0 ){
+		return copyBytes( dest_process, source_process, dest, src, length, dest_virtual, src_virtual );
+	}
+
+	/* bytes before the first whole page */
+	int head = (unsigned long) UP_TO_PAGE( dest ) - (unsigned long) dest;
+	if ( head > length ){
+		head = length;
+	}
+	if ( head > 0 && copyBytes( dest_process, source_process, dest, src, head, dest_virtual, src_virtual ) == ERROR ){
+		return ERROR;
+	}
+	dest += head;
+	src += head;
+	length -= head;
+
+	int base = to_page( VMEM_1_BASE, 0 );
+	while ( length >= PAGESIZE ){
+		int dest_page = to_page( (unsigned long) dest, 0 ) - base;
+		int src_page = to_page( (unsigned long) src, 0 ) - base;
+		struct memory_page * from = source_process->page_table[ src_page ];
+		struct memory_page * to = dest_process->page_table[ dest_page ];
+
+		/* a shared frame has one protection so only plain data pages qualify.
+		 * MapShared pages have to stay what they are.
+		 */
+		if ( from->protection == (PROT_READ | PROT_WRITE) && to->protection == (PROT_READ | PROT_WRITE) &&
+		     ! from->shared && ! to->shared ){
+			TracePrintf( 7, "Share frame %d from page %d to page %d\n", from->frame, src_page, dest_page );
+			sharePage( dest_process->page_table, dest_page, source_process->page_table, src_page );
+		} else if ( copyBytes( dest_process, source_process, dest, src, PAGESIZE, dest_virtual, src_virtual ) == ERROR ){
 			return ERROR;
 		}
+		dest += PAGESIZE;
+		src += PAGESIZE;
+		length -= PAGESIZE;
 	}
 
-	struct ipc * obj = (struct ipc *) malloc( sizeof(struct ipc) );
-	if ( ! obj ){
+	if ( length > 0 ){
+		return copyBytes( dest_process, source_process, dest, src, length, dest_virtual, src_virtual );
+	}
+
+	return 0;
+}
+
+/* copy data in process space from sourceid to destid */
+static int copyProcessSpace( int destid, int sourceid, caddr_t dest, caddr_t src, int length ){
+	struct process * source_process = findProcess( sourceid );
+	struct process * dest_process = findProcess( destid );
+	int dest_virtual, src_virtual;
+	int ret;
+
+	TracePrintf( 6, "[%d] Copy user space: dest id %d dest addr %p source id %d source addr %p length %d\n", current_process->process->id, destid, dest, sourceid, src, length );
+
+	if ( ! source_process || ! dest_process ){
 		return ERROR;
 	}
 
-	int sent = 0;
-	while ( ! sent ){
-		TracePrintf( 5, "[%d] trying to send ipc message to %d\n", current_process->process->id, to );
-		struct process_list * receiver = findReceiver( to );
-		if ( receiver ){
-			memcpy( receiver->process->inbox, message, IPC_MAX_LENGTH );
-			sent = 1;
+	if ( ! checkCopy( dest_process, source_process, dest, src, length ) ){
+		return ERROR;
+	}
 
-			struct ipc * obj = (struct ipc *) receiver->obj;
-			obj->from = current_process->process->id;
-			/* wake the receiver up */
-			// free( receiver->obj );
-			if ( receiver->prev ){
-				receiver->prev->next = receiver->next;
-			}
-			if ( receiver->next ){
-				receiver->next->prev = receiver->prev;
-			}
-			receiver->next = current_process->next;
-			receiver->prev = current_process;
-			current_process->next->prev = receiver;
-			current_process->next = receiver;
+	if ( reserveCopyWindows( &dest_virtual, &src_virtual ) == ERROR ){
+		return ERROR;
+	}
+	ret = copyPages( dest_process, source_process, dest, src, length, dest_virtual, src_virtual );
+	releaseCopyWindows( dest_virtual, src_virtual );
+	return ret;
+}
+
+/* copy every segment between the caller and pid, in the direction given by
+ * 'to'. all the segments are checked before anything is copied and the
+ * copy windows are only mapped once.
+ */
+static int copyVector( int pid, struct copy_segment * segments, int count, int to ){
+	struct process * self = current_process->process;
+	struct process_list * client;
+	struct process * other;
+	int dest_virtual, src_virtual;
+	int i;
+	int ret = 0;
+	int bytes = 0;
+
+	if ( count < 0 || count > COPY_MAX_SEGMENTS || ! ensureRegion1Read( segments, sizeof( struct copy_segment ) * count ) ){
+		return ERROR;
+	}
+	client = findIpc( -1, ipcId( self ), pid );
+	if ( client == 0 ){
+		return ERROR;
+	}
+	other = findProcess( pid );
+	if ( ! other ){
+		return ERROR;
+	}
+
+	TracePrintf( 6, "[%d] Copy %d segments %s %d\n", self->id, count, to ? "to" : "from", pid );
+
+	for ( i = 0; i < count; i++ ){
+		struct copy_segment * segment = &segments[ i ];
+		if ( segment->length < 0 ){
+			return ERROR;
+		}
+		if ( segment->length == 0 ){
+			continue;
+		}
+		if ( to ? ! checkCopy( other, self, segment->remote, segment->local, segment->length ) :
+			  ! checkCopy( self, other, segment->local, segment->remote, segment->length ) ){
+			return ERROR;
+		}
+	}
+
+	if ( reserveCopyWindows( &dest_virtual, &src_virtual ) == ERROR ){
+		return ERROR;
+	}
+	for ( i = 0; i < count && ret == 0; i++ ){
+		struct copy_segment * segment = &segments[ i ];
+		if ( segment->length == 0 ){
+			continue;
+		}
+		if ( to ){
+			ret = copyPages( other, self, segment->remote, segment->local, segment->length, dest_virtual, src_virtual );
 		} else {
-			/* goto sleep */
-			obj->from = current_process->process->id;
-			obj->to = to;
-			obj->receive = -1;
-			current_process->obj = obj;
-			struct process_list * save = current_process->next;
-			struct process * old = current_process->process;
-			if ( current_process->prev ){
-				current_process->prev->next = current_process->next;
-			}
-			if ( current_process->next ){
-				current_process->next->prev = current_process->prev;
-			}
+			ret = copyPages( self, other, segment->local, segment->remote, segment->length, dest_virtual, src_virtual );
+		}
+		if ( ret == 0 ){
+			bytes += segment->length;
+		}
+	}
+	releaseCopyWindows( dest_virtual, src_virtual );
+	recordCopy( client, bytes );
+	return ret;
+}
 
-			addToIpcList( current_process );
+static int handleCopyFrom( int srcpid, caddr_t dest, caddr_t src, int length ){
+	struct process_list * client = findIpc( -1, ipcId( current_process->process ), srcpid );
+	if ( client == 0 ){
+		return ERROR;
+	}
+	if ( copyProcessSpace( current_process->process->id, srcpid, dest, src, length ) != 0 ){
+		return ERROR;
+	}
+	recordCopy( client, length );
+	return 0;
+}
 
-			current_process = skipIdle( save );
-			switchTo( old, current_process->process, context );
+static int handleCopyTo( int destid, caddr_t dest, caddr_t src, int length ){
+	struct process_list * client = findIpc( -1, ipcId( current_process->process ), destid );
+	if ( client == 0 ){
+		return ERROR;
+	}
+	if ( copyProcessSpace( destid, current_process->process->id, dest, src, length ) != 0 ){
+		return ERROR;
+	}
+	recordCopy( client, length );
+	return 0;
+}
+
+static int handleCopyFromV( int srcpid, struct copy_segment * segments, int count ){
+	return copyVector( srcpid, segments, count, 0 );
+}
+
+static int handleCopyToV( int destid, struct copy_segment * segments, int count ){
+	return copyVector( destid, segments, count, 1 );
+}
+
+/* 1 if the heap of leader is below the shared window and its main stack
+ * above it
+ */
+static int sharedWindowFits( struct process * leader ){
+	int base = sharedWindowBase();
+	return leader->heap_end <= base - 1 &&
+	       leader->stack - to_page( VMEM_1_BASE, 0 ) > base + SHARED_PAGES;
+}
+
+/* map 'pages' new zeroed pages at the same place in the shared windows of
+ * the caller and of pid, which has to be waiting for a reply from the
+ * caller. both can read and write them until they UnmapShared them or exit.
+ * returns the address of the pages or ERROR.
+ */
+static int handleMapShared( int pid, int pages ){
+	struct process * self = current_process->process->leader;
+	struct process_list * client;
+	struct process * other;
+	int base = sharedWindowBase();
+	int start;
+	int i;
+
+	client = findIpc( -1, ipcId( current_process->process ), pid );
+	if ( client == 0 || pages < 1 || pages > SHARED_PAGES ){
+		return ERROR;
+	}
+	other = client->process->leader;
+	if ( other == self || ! sharedWindowFits( self ) || ! sharedWindowFits( other ) ){
+		return ERROR;
+	}
+
+	/* lowest run of pages that is free in both windows */
+	for ( start = base; start + pages <= base + SHARED_PAGES; start++ ){
+		for ( i = start; i < start + pages; i++ ){
+			if ( self->page_table[ i ] != 0 || other->page_table[ i ] != 0 ){
+				break;
+			}
+		}
+		if ( i == start + pages ){
+			break;
 		}
 	}
+	if ( start + pages > base + SHARED_PAGES || ! freePages( pages ) ){
+		return ERROR;
+	}
 
-	/* the message has been sent so now go back to sleep until a reply
-	 * has been sent
-	 */
+	for ( i = start; i < start + pages; i++ ){
+		struct memory_page * page = get_free_page();
+		if ( ! page ){
+			return ERROR;
+		}
+		if ( clearPage( page ) != YALNIX_NO_ERROR ){
+			release_page( page );
+			return ERROR;
+		}
+		page->virtual = i;
+		page->protection = PROT_READ | PROT_WRITE;
+		page->shared = 1;
+		self->page_table[ i ] = page;
+		sharePage( other->page_table, i, self->page_table, i );
+		self->shared_pages += 1;
+		other->shared_pages += 1;
+	}
 
-	obj->receive = current_process->process->id;
-	obj->to = -1;
-	/* not explicitly mentioned in the docs but this process should only
-	 * get the reply from the process it just sent to.
+	TracePrintf( 5, "[%d] Shared %d pages at page %d with [%d]\n", self->id, pages, start, other->id );
+	return VMEM_1_BASE + (start << PAGESHIFT);
+}
+
+/* unmap pages of the caller's shared window starting at addr. the frames
+ * are freed once nobody maps them anymore.
+ */
+static int handleUnmapShared( caddr_t addr, int pages ){
+	struct process * self = current_process->process->leader;
+	int base = sharedWindowBase();
+	int start = to_page( (unsigned long) addr, 0 ) - to_page( VMEM_1_BASE, 0 );
+	int i;
+
+	if ( ((unsigned long) addr & PAGEOFFSET) || pages < 1 || start < base || start + pages > base + SHARED_PAGES ){
+		return ERROR;
+	}
+	/* the heap or main stack may have grown into the window while nothing
+	 * was mapped there, only pages MapShared made can go
 	 */
-	obj->from = to;
-	current_process->obj = obj;
+	for ( i = start; i < start + pages; i++ ){
+		if ( self->page_table[ i ] == 0 || ! self->page_table[ i ]->shared ){
+			return ERROR;
+		}
+	}
+	for ( i = start; i < start + pages; i++ ){
+		modifyPageTable1( i, 0, 0, 0 );
+		WriteRegister( REG_TLB_FLUSH, VMEM_1_BASE + (i << PAGESHIFT) );
+		release_page( self->page_table[ i ] );
+		self->page_table[ i ] = 0;
+		self->shared_pages -= 1;
+	}
+	return 0;
+}
+
+static int handleReadSector( UserContext * context, int sector, caddr_t dest ){
+	if ( ! ensureRegion1Read( dest, SECTORSIZE ) ){
+		return ERROR;
+	}
+
+	if ( sector < 1 || sector >= NUMSECTORS ){
+		return ERROR;
+	}
+
+	char * buffer = (char *) malloc( SECTORSIZE );
+	if ( ! buffer ){
+		return ERROR;
+	}
+	bzero( buffer, SECTORSIZE );
+
+	DiskAccess( DISK_READ, sector, buffer );
 
 	struct process_list * save = current_process->next;
 	struct process * old = current_process->process;
@@ -904,69 +2627,44 @@ static int handleSend( UserContext * context, caddr_t message, int to ){
 		current_process->prev->next = current_process->next;
 	}
 	if ( current_process->next ){
-		current_process->next->prev = current_process->prev;
-	}
-	addToIpcList( current_process );
-	// current_process = skipIdle( putProcessOnList( &ipc_list, current_process ) );
-	current_process = skipIdle( save );
+		current_process->next->prev = current_process->prev;
+	}
+
+	/* the buffer goes with the process so a kill after the transfer
+	 * frees it
+	 */
+	current_process->obj = buffer;
+	addToDiskList( current_process );
 
+	current_process = skipIdle( save );
+	TracePrintf( 5, "[%d] waiting for disk read\n", old->id );
 	switchTo( old, current_process->process, context );
-	memcpy( message, current_process->process->inbox, IPC_MAX_LENGTH );
-	free( obj );
+
 	current_process->obj = 0;
+	memcpy( dest, buffer, SECTORSIZE );
+	free( buffer );
+	current_process->process->usage.sectors += 1;
 
 	return 0;
 }
 
-static void wakeupSenders( int to, int from ){
-	struct process_list * sender = findSender( to, from );
-	if ( sender ){
-		if ( sender->prev ){
-			sender->prev->next = sender->next;
-		}
-		if ( sender->next ){
-			sender->next->prev = sender->prev;
-		}
-		sender->next = current_process->next;
-		sender->prev = current_process;
-		current_process->next->prev = sender;
-		current_process->next = sender;
-		TracePrintf( 5, "[%d] Woke up %p %d\n", current_process->process->id, sender->process, sender->process->id );
+static int handleWriteSector( UserContext * context, int sector, caddr_t src ){
+	if ( ! ensureRegion1ReadWrite( src, SECTORSIZE ) ){
+		return ERROR;
 	}
-}
-
-/* receive an ipc message.
- * First wake up a process that might be trying to send to this process.
- * Then this process adds itself to the ipc list waiting for the sender to
- * push his message out. The sender will wake this process back up and
- * finally the sender's pid is returned.
- *
- * If from is -1 then any process can send to this one. If it is some positive
- * number then only the process with id 'from' can send to it.
- */
-static int handleReceive( UserContext * context, char * buffer, int from ){
 	
-	if ( ! ensureRegion1ReadWrite( buffer, IPC_MAX_LENGTH ) ){
+	if ( sector < 1 || sector >= NUMSECTORS ){
 		return ERROR;
 	}
 
-	struct ipc * obj = (struct ipc *) malloc( sizeof( struct ipc ) );
-	if ( ! obj ){
+	char * buffer = (char *) malloc( SECTORSIZE );
+	if ( ! buffer ){
 		return ERROR;
 	}
+	memcpy( buffer, src, SECTORSIZE );
 
-	obj->receive = current_process->process->id;
-	obj->to = -1;
-	obj->from = from;
-
-	current_process->obj = obj;
-
-	/* wake up any processes that want to send to this process */
-	wakeupSenders( current_process->process->id, from );
+	DiskAccess( DISK_WRITE, sector, buffer );
 
-	/* put self in the ipc list and goto sleep. the sender will
-	 * wake this process back up.
-	 */
 	struct process_list * save = current_process->next;
 	struct process * old = current_process->process;
 	if ( current_process->prev ){
@@ -976,304 +2674,541 @@ static int handleReceive( UserContext * context, char * buffer, int from ){
 		current_process->next->prev = current_process->prev;
 	}
 
-	addToIpcList( current_process );
+	/* the buffer goes with the process so a kill after the transfer
+	 * frees it
+	 */
+	current_process->obj = buffer;
+	addToDiskList( current_process );
 
 	current_process = skipIdle( save );
-	TracePrintf( 5, "[%d] waiting to receive\n", old->id );
+	TracePrintf( 5, "[%d] waiting for disk write\n", old->id );
 	switchTo( old, current_process->process, context );
 
-	memcpy( buffer, current_process->process->inbox, IPC_MAX_LENGTH );
-
-	obj = (struct ipc *) current_process->obj;
-	int id = obj->from;
-	free( obj );
 	current_process->obj = 0;
+	free( buffer );
+	current_process->process->usage.sectors += 1;
 
-	return id;
+	return 0;
 }
 
-/* send an ipc message back to some process.
- * if there is no process waiting for a reply then return ERROR.
- * otherwise copy the message to that process's inbox and put
- * the process back on the run queue.
- */
-static int handleReply( UserContext * context ){
-	char * message = (char *) context->regs[ 0 ];	
-	int to = context->regs[ 1 ];
-
-	if ( ! ensureRegion1Read( message, IPC_MAX_LENGTH ) ){
+/* copy the resources used by the current process, or its reaped children, to the user */
+static int handleGetRusage( int who, struct usage * usage ){
+	struct process * process = current_process->process;
+	if ( ! ensureRegion1ReadWrite( usage, sizeof( struct usage ) ) ){
 		return ERROR;
 	}
-
-	struct process_list * list = findReceiverSpecific( current_process->process->id, to );
-	if ( ! list ){
-		/* no one is waiting for a reply */
-		return -1;
-	} else {
-		if ( list->prev ){
-			list->prev->next = list->next;
+	switch ( who ){
+		case USAGE_SELF : {
+			chargeTime( process, &process->usage.kernel_time );
+			*usage = process->usage;
+			return 0;
 		}
-		if ( list->next ){
-			list->next->prev = list->prev;
+		case USAGE_CHILDREN : {
+			*usage = process->child_usage;
+			return 0;
 		}
-		list->next = current_process->next;
-		list->prev = current_process;
-		current_process->next->prev = list;
-		current_process->next = list;
-
-		memcpy( list->process->inbox, message, IPC_MAX_LENGTH );
 	}
-
-	return 0;
+	return ERROR;
 }
 
-/* register a service on a given port */
-static int handleRegister( unsigned int port ){
-	if ( findService( port ) ){
+/* copy the ipc counters of a process or a port to the user */
+static int handleIpcStats( int who, int id, struct ipc_stats * stats ){
+	if ( ! ensureRegion1ReadWrite( stats, sizeof( struct ipc_stats ) ) ){
 		return ERROR;
 	}
-
-	if ( ! registered_servers ){
-		max_servers = 4;
-		registered_servers = (struct service *) malloc( sizeof( struct service ) * max_servers );
-		if ( ! registered_servers ){
-			return ERROR;
+	switch ( who ){
+		case IPC_STATS_PROCESS : {
+			struct process * process = id == 0 ? current_process->process : findProcess( id );
+			if ( ! process ){
+				return ERROR;
+			}
+			*stats = process->leader->ipc_stats;
+			return 0;
 		}
-		int i;
-		for ( i = 0; i < max_servers; i++ ){
-			registered_servers[i] = (struct service){ .port = 0, .id = -1 };
+		case IPC_STATS_PORT : {
+			struct ipc_stats * port = findPortStats( id, 0 );
+			if ( ! port ){
+				return ERROR;
+			}
+			*stats = *port;
+			return 0;
 		}
 	}
+	return ERROR;
+}
 
-	int index = 0;
-	for ( index = 0; index < max_servers && registered_servers[ index ].id != -1; index++ ){
+/* take the current process off the run list until someone hands it the
+ * semaphore, lock or cvar it is queued on
+ */
+static void blockOnSync( UserContext * context ){
+	struct process_list * save = current_process->next;
+	struct process * old = current_process->process;
+	struct process_list * list = old->list;
+	if ( list->prev ){
+		list->prev->next = list->next;
+	}
+	if ( list->next ){
+		list->next->prev = list->prev;
 	}
 
-	/* grow the servers list */
-	if ( index == max_servers ){
-		int new_max = max_servers * 2;
-		struct service * new_servers = (struct service *) malloc( sizeof( struct service ) * new_max );
-		if ( ! new_servers ){
-			return ERROR;
-		}
-		int i;
-		for ( i = max_servers; i < new_max; i++ ){
-			registered_servers[i] = (struct service){ .port = 0, .id = -1 };
+	addToBusyList( list );
+
+	current_process = skipIdle( save );
+	switchTo( old, current_process->process, context );
+}
+
+/* 1 if input from terminal tty is waiting to be read */
+static int ttyReadable( int tty ){
+	return terminals[ tty ].input_count > 0;
+}
+
+/* 1 if Receive would get a message without blocking for a sender */
+static int messageWaiting( struct process * leader ){
+	int i;
+	if ( leader->mailbox && leader->mailbox->count > 0 ){
+		return 1;
+	}
+	if ( findSender( leader->id, -1 ) ){
+		return 1;
+	}
+	for ( i = 0; i < max_servers; i++ ){
+		if ( registered_servers[ i ].id == leader->id && findPortSender( registered_servers[ i ].port ) ){
+			return 1;
 		}
-		memcpy( new_servers, registered_servers, sizeof( struct service ) * max_servers );
-		free( registered_servers );
-		registered_servers = new_servers;
-		max_servers = new_max;
 	}
-
-	registered_servers[ index ] = (struct service){ .port = port, .id = current_process->process->id };
 	return 0;
 }
 
-/* copy data in process space from sourceid to destid.
- * This function doesn't care if either process is currently mapped in,
- * it will map each frame that needs to be copied to some unused virtual
- * page in region 0 and copy the bytes from there.
- *
- * All the src_/dest_ variables are for when the addresses don't align
- * within their respective pages. e.g:
- * dest = 0x5140
- * src = 0xe523
- * And assume there is a page boundary at 0x5000, 0x6000, 0xe000, 0xf000.
- * Then there are less bytes from 0xf000 - src than there are in
- * 0x6000 - dest.
- */
-static int copyProcessSpace( int destid, int sourceid, caddr_t dest, caddr_t src, int length ){
-	struct process * source_process = findProcess( sourceid );
-	struct process * dest_process = findProcess( destid );
+/* the events of 'events' that are ready for process */
+static int selectReady( struct process * process, int events ){
+	int ready = 0;
+	int tty;
+	for ( tty = 0; tty < NUM_TERMINALS; tty++ ){
+		if ( (events & SELECT_TTY( tty )) && ttyReadable( tty ) ){
+			ready |= SELECT_TTY( tty );
+		}
+	}
+	if ( (events & SELECT_MESSAGE) && messageWaiting( process->leader ) ){
+		ready |= SELECT_MESSAGE;
+	}
+	if ( (events & SELECT_CHILD) && process->terminated.next != 0 ){
+		ready |= SELECT_CHILD;
+	}
+	if ( (events & SELECT_DOORBELL) && process->leader->doorbell ){
+		ready |= SELECT_DOORBELL;
+	}
+	return ready;
+}
 
-	TracePrintf( 6, "[%d] Copy user space: dest id %d dest addr %p source id %d source addr %p length %d\n", current_process->process->id, destid, dest, sourceid, src, length );
+/* block until one of the events is ready or ticks clock ticks have gone by,
+ * -1 is forever and 0 only looks. returns the ready events, 0 on timeout.
+ * only a doorbell is consumed, the caller still has to TtyRead, Receive or
+ * Wait.
+ */
+static int handleSelect( UserContext * context, int events, int ticks ){
+	struct process * process = current_process->process;
+	int ready;
 
-	if ( ! source_process || ! dest_process ){
+	if ( ticks < -1 || (events & ~SELECT_ALL) ){
 		return ERROR;
 	}
 
-	if ( ! ensureReadInTable( source_process->page_table, src, length ) ){
-		TracePrintf( 6, "[kernel] %p is not a valid address in the source process\n", src );
-		return ERROR;
+	if ( ticks > 0 ){
+		startTimer( process, ticks );
 	}
+	while ( (ready = selectReady( process, events )) == 0 && ticks != 0 && ! process->timed_out ){
+		process->select_events = events;
+		process->next_waiter = selectors;
+		selectors = process;
+		blockOnSync( context );
+		removeSelector( process );
+	}
+	stopTimer( process );
+	process->timed_out = 0;
+	process->select_events = 0;
+	if ( ready & SELECT_DOORBELL ){
+		process->leader->doorbell = 0;
+	}
+	return ready;
+}
 
-	if ( ! ensureReadWriteInTable( dest_process->page_table, dest, length ) ){
-		TracePrintf( 6, "[kernel] %p is not a valid address in the destination process\n", dest );
+/* tell pid that there is work for it without a message. rings that come
+ * before its next Select are merged into one.
+ */
+static int handleDoorbell( int pid ){
+	struct process * target = findProcess( pid );
+	if ( ! target || target->status == PROCESS_DIED ){
 		return ERROR;
 	}
+	target = target->leader;
+	if ( ! target->doorbell ){
+		target->doorbell = 1;
+		wakeSelectors( target->id, SELECT_DOORBELL );
+	}
+	return 0;
+}
 
-	/* find an unused page in region 0 to do the copying  */
-	int dest_virtual = findUnusedPage0();
-	if ( dest_virtual == -1 ){
+/* create a semaphore, lock or cvar and store its handle in id */
+static int handleSyncInit( int type, int * id, int value ){
+	int handle;
+	if ( value < 0 || ! ensureRegion1ReadWrite( id, sizeof( int ) ) ){
 		return ERROR;
 	}
-	TracePrintf( 8, "Dest virtual %d\n", dest_virtual );
-	mapUnusedPage0( 0, dest_virtual );
-	int src_virtual = findUnusedPage0();
-	if ( src_virtual == -1 ){
-		unMapPage0( dest_virtual );
+	handle = createSync( type, value );
+	if ( handle == ERROR ){
 		return ERROR;
 	}
-	TracePrintf( 8, "Src virtual %d\n", src_virtual );
-	mapUnusedPage0( 0, src_virtual );
-	
-	/* current page in process space for each process */
-	int dest_page = to_page( (unsigned long) dest, 0 ) - to_page( VMEM_1_BASE, 0 );
-	int src_page = to_page( (unsigned long) src, 0 ) - to_page( VMEM_1_BASE, 0 );
-		
-	/* max bytes that can be copied from this page */
-	int dest_max = length > (unsigned long)UP_TO_PAGE( dest + 1 ) - (long)dest ? (unsigned long)UP_TO_PAGE( dest + 1 ) - (long)dest : length;
-	/* starting address within the page */
-	int dest_begin = (unsigned long) dest - (unsigned long) DOWN_TO_PAGE( dest );
-
-	int source_max = length > (unsigned long) UP_TO_PAGE( src + 1 ) - (unsigned long) src ? (unsigned long) UP_TO_PAGE( src + 1 ) - (unsigned long) src : length;
-	int source_begin = (unsigned long) src - (unsigned long) DOWN_TO_PAGE( src );
-		
-	/* map the same physical frame being used by the process to the region 0 page */		
-	mapUnusedPage0( dest_process->page_table[ dest_page ]->frame, dest_virtual );
-	mapUnusedPage0( source_process->page_table[ src_page ]->frame, src_virtual );
-
-	TracePrintf( 7, "Map dest virtual %d to physical %d\n", dest_virtual, dest_page );
-	TracePrintf( 7, "Map src virtual %d to physical %d\n", src_virtual, src_page );
-
-	while ( length > 0 ){
-		/* copy the fewest allowed bytes */
-		int min = dest_max < source_max ? dest_max : source_max;
-
-		unsigned long dest_addr = (dest_virtual << PAGESHIFT) + dest_begin;
-		unsigned long src_addr = (src_virtual << PAGESHIFT) + source_begin;
-
-		length -= min;
-		TracePrintf( 7, "Copy %d bytes from %p to %p. Remaining %d\n", min, src_addr, dest_addr, length );
-
-		memcpy( (void *) dest_addr, (void *) src_addr, min );
-
-		if ( length == 0 ){
-			break;
-		}
-
-		dest_max -= min;
-		source_max -= min;
-		dest_begin += min;
-		source_begin += min;
-		TracePrintf( 7, "Dest page %d max %d dest begin %d\n", dest_page, dest_max, dest_begin );
-		TracePrintf( 7, "Src page %d max %d src begin %d\n", src_page, source_max, source_begin );
-		/* if dest ran out of bytes to copy then find the next page */
-		if ( dest_max == 0 ){
-			dest_page += 1;
-			dest_begin = 0;
-			dest_max = length < PAGESIZE ? length : PAGESIZE;
-			mapUnusedPage0( dest_process->page_table[ dest_page ]->frame, dest_virtual );
-		}
+	*id = handle;
+	return 0;
+}
 
-		/* same for src */
-		if ( source_max == 0 ){
-			src_page += 1;
-			source_begin = 0;
-			source_max = length < PAGESIZE ? length : PAGESIZE;
-			mapUnusedPage0( source_process->page_table[ src_page ]->frame, src_virtual );
-		}
+static int handleSemDown( UserContext * context, int id ){
+	struct sync_object * semaphore = findSync( id, SYNC_SEMAPHORE );
+	if ( ! semaphore ){
+		return ERROR;
 	}
+	if ( semaphore->value > 0 ){
+		semaphore->value -= 1;
+		return 0;
+	}
+	enqueueWaiter( &semaphore->waiters, current_process->process );
+	blockOnSync( context );
+	/* SemUp gave its unit straight to us */
+	return 0;
+}
 
-	/* dont leave bogus pages mapped into region 0 */
-	unMapPage0( dest_virtual );
-	unMapPage0( src_virtual );
+static int handleSemUp( int id ){
+	struct sync_object * semaphore = findSync( id, SYNC_SEMAPHORE );
+	struct process * waiter;
+	if ( ! semaphore ){
+		return ERROR;
+	}
+	waiter = dequeueWaiter( &semaphore->waiters );
+	if ( waiter ){
+		wakeupParent( waiter );
+	} else {
+		semaphore->value += 1;
+	}
+	return 0;
+}
 
+static int handleAcquire( UserContext * context, int id ){
+	struct sync_object * lock = findSync( id, SYNC_LOCK );
+	struct process * process = current_process->process;
+	if ( ! lock || lock->holder == process ){
+		return ERROR;
+	}
+	if ( lock->holder == 0 ){
+		lock->holder = process;
+		return 0;
+	}
+	enqueueWaiter( &lock->waiters, process );
+	blockOnSync( context );
+	/* Release made us the holder */
 	return 0;
 }
 
-static int handleCopyFrom( int srcpid, caddr_t dest, caddr_t src, int length ){
-	if ( findIpc( -1, current_process->process->id, srcpid ) == 0 ){
+static int handleRelease( int id ){
+	struct sync_object * lock = findSync( id, SYNC_LOCK );
+	if ( ! lock || lock->holder != current_process->process ){
 		return ERROR;
 	}
-	return copyProcessSpace( current_process->process->id, srcpid, dest, src, length );
+	handOffLock( lock );
+	return 0;
 }
 
-static int handleCopyTo( int destid, caddr_t dest, caddr_t src, int length ){
-	if ( findIpc( -1, current_process->process->id, destid ) == 0 ){
-		return ERROR;
+/* move the oldest waiter of a cvar over to its lock. the waiter only runs
+ * again once it holds the lock, so it never wakes up just to block on the
+ * lock. returns 0 if nobody was waiting.
+ */
+static int wakeCvarWaiter( struct sync_object * cvar ){
+	struct process * waiter = dequeueWaiter( &cvar->waiters );
+	struct sync_object * lock;
+	if ( ! waiter ){
+		return 0;
+	}
+	/* Reclaim refuses locks that cvar waiters still need */
+	lock = findSync( waiter->cvar_lock, SYNC_LOCK );
+	if ( lock->holder == 0 ){
+		lock->holder = waiter;
+		wakeupParent( waiter );
+	} else {
+		enqueueWaiter( &lock->waiters, waiter );
 	}
-	return copyProcessSpace( destid, current_process->process->id, dest, src, length );
+	return 1;
 }
 
-static int handleReadSector( UserContext * context, int sector, caddr_t dest ){
-	if ( ! ensureRegion1Read( dest, SECTORSIZE ) ){
+static int handleCvarWait( UserContext * context, int cvar_id, int lock_id ){
+	struct sync_object * cvar = findSync( cvar_id, SYNC_CVAR );
+	struct sync_object * lock = findSync( lock_id, SYNC_LOCK );
+	struct process * process = current_process->process;
+	if ( ! cvar || ! lock || lock->holder != process ){
 		return ERROR;
 	}
+	process->cvar_lock = lock_id;
+	enqueueWaiter( &cvar->waiters, process );
+	handOffLock( lock );
+	blockOnSync( context );
+	process->cvar_lock = -1;
+	return 0;
+}
 
-	if ( sector < 1 || sector >= NUMSECTORS ){
+static int handleCvarSignal( int id, int all ){
+	struct sync_object * cvar = findSync( id, SYNC_CVAR );
+	if ( ! cvar ){
 		return ERROR;
 	}
+	while ( wakeCvarWaiter( cvar ) && all ){
+	}
+	return 0;
+}
 
-	char * buffer = (char *) malloc( SECTORSIZE );
-	if ( ! buffer ){
+/* futexes are told apart by the physical address of the int, so every
+ * process that maps the same frame finds the same futex. fails if addr
+ * is not an aligned int the process can write.
+ */
+static int futexKey( struct process * process, int * addr, unsigned long * key ){
+	struct memory_page * page;
+	if ( ((unsigned long) addr & (sizeof( int ) - 1)) != 0 ||
+	     ! ensureRegion1ReadWrite( addr, sizeof( int ) ) ){
 		return ERROR;
 	}
-	bzero( buffer, SECTORSIZE );
-
-	DiskAccess( DISK_READ, sector, buffer );
-
-	struct process_list * save = current_process->next;
-	struct process * old = current_process->process;
-	if ( current_process->prev ){
-		current_process->prev->next = current_process->next;
+	/* a copy on write page would get a new frame on the next store to
+	 * it, and with it a new key. waiter and waker both take their own
+	 * copy now so they agree on the frame.
+	 */
+	if ( unshareRange( process->page_table, addr, sizeof( int ) ) == -1 ){
+		return ERROR;
 	}
-	if ( current_process->next ){
-		current_process->next->prev = current_process->prev;
+	page = process->page_table[ ((unsigned long) addr - VMEM_1_BASE) >> PAGESHIFT ];
+	if ( ! page ){
+		return ERROR;
 	}
-
-	addToDiskList( current_process );
-
-	current_process = skipIdle( save );
-	TracePrintf( 5, "[%d] waiting for disk read\n", old->id );
-	switchTo( old, current_process->process, context );
-
-	memcpy( dest, buffer, SECTORSIZE );
-	free( buffer );
-
+	*key = ((unsigned long) page->frame << PAGESHIFT) | ((unsigned long) addr & PAGEOFFSET);
 	return 0;
 }
 
-static int handleWriteSector( UserContext * context, int sector, caddr_t src ){
-	if ( ! ensureRegion1ReadWrite( src, SECTORSIZE ) ){
+static int handleFutexWait( UserContext * context, int * addr, int value ){
+	struct process * process = current_process->process;
+	unsigned long key;
+	if ( futexKey( process, addr, &key ) != 0 ){
 		return ERROR;
 	}
-	
-	if ( sector < 1 || sector >= NUMSECTORS ){
-		return ERROR;
+	/* nothing else runs between the check and going to sleep */
+	if ( *addr != value ){
+		return 1;
 	}
+	futexEnqueue( key, process );
+	blockOnSync( context );
+	return 0;
+}
 
-	char * buffer = (char *) malloc( SECTORSIZE );
-	if ( ! buffer ){
+static int handleFutexWake( int * addr, int count ){
+	unsigned long key;
+	struct process * waiter;
+	int woken = 0;
+	if ( futexKey( current_process->process, addr, &key ) != 0 ){
 		return ERROR;
 	}
-	memcpy( buffer, src, SECTORSIZE );
-
-	DiskAccess( DISK_WRITE, sector, buffer );
+	while ( woken < count && (waiter = futexDequeue( key )) != 0 ){
+		wakeupParent( waiter );
+		woken += 1;
+	}
+	return woken;
+}
 
-	struct process_list * save = current_process->next;
-	struct process * old = current_process->process;
-	if ( current_process->prev ){
-		current_process->prev->next = current_process->next;
+static int handlePipeCreate( int * id ){
+	int handle;
+	if ( ! ensureRegion1ReadWrite( id, sizeof( int ) ) ){
+		return ERROR;
 	}
-	if ( current_process->next ){
-		current_process->next->prev = current_process->prev;
+	handle = createPipe( current_process->process->leader->id );
+	if ( handle == ERROR ){
+		return ERROR;
 	}
+	*id = handle;
+	return 0;
+}
 
-	addToDiskList( current_process );
+static int handleRedirect( int in, int out ){
+	if ( (in != -1 && ! findPipe( in )) || (out != -1 && ! findPipe( out )) ){
+		return ERROR;
+	}
+	setPipes( current_process->process->leader, in, out );
+	return 0;
+}
 
-	current_process = skipIdle( save );
-	TracePrintf( 5, "[%d] waiting for disk write\n", old->id );
-	switchTo( old, current_process->process, context );
+/* TtyRead of a process whose input is a pipe. returns what is buffered,
+ * blocking until there is something, or 0 at end of file.
+ */
+static int handlePipeRead( UserContext * context, int handle, char * buffer, int length ){
+	struct pipe * pipe;
+	int got;
+	if ( length <= 0 || ! ensureRegion1ReadWrite( buffer, length ) ){
+		return ERROR;
+	}
+	while ( (pipe = findPipe( handle )) != 0 && pipe->count == 0 ){
+		if ( pipe->writers == 0 ){
+			return 0;
+		}
+		enqueueWaiter( &pipe->read_waiters, current_process->process );
+		blockOnSync( context );
+		/* the buffer may have been unmapped or shared while we slept */
+		if ( ! ensureRegion1ReadWrite( buffer, length ) ){
+			return ERROR;
+		}
+	}
+	if ( ! pipe ){
+		return ERROR;
+	}
+	got = pipeRead( pipe, buffer, length );
+	wakeAll( &pipe->write_waiters );
+	return got;
+}
 
-	free( buffer );
+/* TtyWrite of a process whose output is a pipe. blocks until all of
+ * buffer is in the pipe. fails if nobody reads the pipe.
+ */
+static int handlePipeWrite( UserContext * context, int handle, char * buffer, int length ){
+	struct pipe * pipe;
+	int written = 0;
+	if ( length <= 0 || ! ensureRegion1Read( buffer, length ) ){
+		return ERROR;
+	}
+	while ( written < length ){
+		pipe = findPipe( handle );
+		if ( ! pipe || pipe->readers == 0 ){
+			return written > 0 ? written : ERROR;
+		}
+		if ( pipe->count == PIPE_SIZE ){
+			enqueueWaiter( &pipe->write_waiters, current_process->process );
+			blockOnSync( context );
+			/* the rest of the buffer may have been unmapped while we slept */
+			if ( ! ensureRegion1Read( buffer + written, length - written ) ){
+				return written > 0 ? written : ERROR;
+			}
+			continue;
+		}
+		written += pipeWrite( pipe, buffer + written, length - written );
+		wakeAll( &pipe->read_waiters );
+	}
+	return written;
+}
 
-	return 0;
+/* extra system calls multiplexed over Custom0, see syscalls.h */
+static void handleCustom( UserContext * context ){
+	switch ( context->regs[ 0 ] ){
+		case SYSCALL_SPAWN : {
+			handleSpawn( context, (char *) context->regs[ 1 ], (char **) context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_THREAD_CREATE : {
+			handleThreadCreate( context, (void *) context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_GET_RUSAGE : {
+			context->regs[ 0 ] = handleGetRusage( context->regs[ 1 ], (struct usage *) context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_WAIT_PID : {
+			context->regs[ 0 ] = handleWaitPid( context, current_process->process, context->regs[ 1 ], (int *) context->regs[ 2 ], context->regs[ 3 ] );
+			break;
+		}
+		case SYSCALL_THREAD_JOIN : {
+			context->regs[ 0 ] = handleThreadJoin( context, context->regs[ 1 ], (int *) context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_THREAD_EXIT : {
+			handleThreadExit( context, context->regs[ 1 ] );
+			break;
+		}
+		case SYSCALL_FUTEX_WAIT : {
+			context->regs[ 0 ] = handleFutexWait( context, (int *) context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_FUTEX_WAKE : {
+			context->regs[ 0 ] = handleFutexWake( (int *) context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_PIPE_CREATE : {
+			context->regs[ 0 ] = handlePipeCreate( (int *) context->regs[ 1 ] );
+			break;
+		}
+		case SYSCALL_REDIRECT : {
+			context->regs[ 0 ] = handleRedirect( context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_SEND_ASYNC : {
+			context->regs[ 0 ] = handleSendAsync( (caddr_t) context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_REPLY_AND_RECEIVE : {
+			context->regs[ 0 ] = handleReplyAndReceive( context, (char *) context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_RECEIVE_TIMEOUT : {
+			if ( (int) context->regs[ 2 ] < 0 ){
+				context->regs[ 0 ] = ERROR;
+			} else {
+				context->regs[ 0 ] = handleReceive( context, (char *) context->regs[ 1 ], -1, context->regs[ 2 ] );
+			}
+			break;
+		}
+		case SYSCALL_SELECT : {
+			context->regs[ 0 ] = handleSelect( context, context->regs[ 1 ] | context->regs[ 2 ], context->regs[ 3 ] );
+			break;
+		}
+		case SYSCALL_MAP_SHARED : {
+			context->regs[ 0 ] = handleMapShared( context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_UNMAP_SHARED : {
+			context->regs[ 0 ] = handleUnmapShared( (caddr_t) context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_DOORBELL : {
+			context->regs[ 0 ] = handleDoorbell( context->regs[ 1 ] );
+			break;
+		}
+		case SYSCALL_GROUP_CREATE : {
+			context->regs[ 0 ] = handleGroupCreate( (int *) context->regs[ 1 ] );
+			break;
+		}
+		case SYSCALL_GROUP_JOIN : {
+			context->regs[ 0 ] = joinGroup( context->regs[ 1 ], current_process->process->leader->id );
+			break;
+		}
+		case SYSCALL_GROUP_LEAVE : {
+			context->regs[ 0 ] = leaveGroup( context->regs[ 1 ], current_process->process->leader->id );
+			break;
+		}
+		case SYSCALL_GROUP_NOTIFY : {
+			context->regs[ 0 ] = handleGroupNotify( (caddr_t) context->regs[ 1 ], context->regs[ 2 ] );
+			break;
+		}
+		case SYSCALL_IPC_STATS : {
+			context->regs[ 0 ] = handleIpcStats( context->regs[ 1 ], context->regs[ 2 ], (struct ipc_stats *) context->regs[ 3 ] );
+			break;
+		}
+		case SYSCALL_COPY_FROM_V : {
+			context->regs[ 0 ] = handleCopyFromV( context->regs[ 1 ], (struct copy_segment *) context->regs[ 2 ], context->regs[ 3 ] );
+			break;
+		}
+		case SYSCALL_COPY_TO_V : {
+			context->regs[ 0 ] = handleCopyToV( context->regs[ 1 ], (struct copy_segment *) context->regs[ 2 ], context->regs[ 3 ] );
+			break;
+		}
+		default : {
+			printf( "Warning: unimplemented custom syscall %d\n", (int) context->regs[ 0 ] );
+			context->regs[ 0 ] = ERROR;
+			break;
+		}
+	}
 }
 
 static void kernelTrap( UserContext * context ){
 	TracePrintf( 8, "[%d] Kernel trap syscall vector %d code %p pc %p\n", current_process->process->id, context->vector, (void *) context->code, context->pc );
+	current_process->process->usage.syscalls += 1;
 	switch ( context->code ){
 		case YALNIX_FORK : {
 			handleFork( context );
@@ -1301,7 +3236,12 @@ static void kernelTrap( UserContext * context ){
 			int tty = context->regs[ 0 ];
 			void * buf = (void *)context->regs[ 1 ];
 			int length = context->regs[ 2 ];
+			struct process * leader = current_process->process->leader;
 
+			if ( leader->pipe_in != -1 ){
+				context->regs[ 0 ] = handlePipeRead( context, leader->pipe_in, buf, length );
+				break;
+			}
 			context->regs[ 0 ] = handleTtyRead( context, current_process->process, tty, buf, length );
 
 			break;
@@ -1310,7 +3250,12 @@ static void kernelTrap( UserContext * context ){
 			int tty = context->regs[ 0 ];
 			void * buf = (void *)context->regs[ 1 ];
 			int length = context->regs[ 2 ];
+			struct process * leader = current_process->process->leader;
 
+			if ( leader->pipe_out != -1 ){
+				context->regs[ 0 ] = handlePipeWrite( context, leader->pipe_out, buf, length );
+				break;
+			}
 			context->regs[ 0 ] = handleTtyWrite( context, current_process->process, tty, buf, length );
 			break;
 		}
@@ -1336,15 +3281,19 @@ static void kernelTrap( UserContext * context ){
 			break;
 		}
 		case YALNIX_RECEIVE : {
-			context->regs[ 0 ] = handleReceive( context, (char *) context->regs[ 0 ], -1 );
+			context->regs[ 0 ] = handleReceive( context, (char *) context->regs[ 0 ], -1, -1 );
 			break;
 		}
 		case YALNIX_RECEIVESPECIFIC : {
-			context->regs[ 0 ] = handleReceive( context, (char *) context->regs[ 0 ], (int) context->regs[ 1 ] );
+			context->regs[ 0 ] = handleReceive( context, (char *) context->regs[ 0 ], (int) context->regs[ 1 ], -1 );
 			break;
 		}
 		case YALNIX_REPLY : {
-			context->regs[ 0 ] = handleReply( context );
+			context->regs[ 0 ] = handleReply( (char *) context->regs[ 0 ], context->regs[ 1 ] );
+			break;
+		}
+		case YALNIX_FORWARD : {
+			context->regs[ 0 ] = handleForward( (caddr_t) context->regs[ 0 ], context->regs[ 1 ], context->regs[ 2 ] );
 			break;
 		}
 		case YALNIX_REGISTER : {
@@ -1364,16 +3313,56 @@ static void kernelTrap( UserContext * context ){
 			context->regs[ 0 ] = handleWait( context, current_process->process, status );
 			break;
 		}
+		case YALNIX_SEM_INIT : {
+			context->regs[ 0 ] = handleSyncInit( SYNC_SEMAPHORE, (int *) context->regs[ 0 ], context->regs[ 1 ] );
+			break;
+		}
+		case YALNIX_SEM_UP : {
+			context->regs[ 0 ] = handleSemUp( context->regs[ 0 ] );
+			break;
+		}
+		case YALNIX_SEM_DOWN : {
+			context->regs[ 0 ] = handleSemDown( context, context->regs[ 0 ] );
+			break;
+		}
+		case YALNIX_LOCK_INIT : {
+			context->regs[ 0 ] = handleSyncInit( SYNC_LOCK, (int *) context->regs[ 0 ], 0 );
+			break;
+		}
+		case YALNIX_LOCK_ACQUIRE : {
+			context->regs[ 0 ] = handleAcquire( context, context->regs[ 0 ] );
+			break;
+		}
+		case YALNIX_LOCK_RELEASE : {
+			context->regs[ 0 ] = handleRelease( context->regs[ 0 ] );
+			break;
+		}
+		case YALNIX_CVAR_INIT : {
+			context->regs[ 0 ] = handleSyncInit( SYNC_CVAR, (int *) context->regs[ 0 ], 0 );
+			break;
+		}
+		case YALNIX_CVAR_WAIT : {
+			context->regs[ 0 ] = handleCvarWait( context, context->regs[ 0 ], context->regs[ 1 ] );
+			break;
+		}
+		case YALNIX_CVAR_SIGNAL : {
+			context->regs[ 0 ] = handleCvarSignal( context->regs[ 0 ], 0 );
+			break;
+		}
+		case YALNIX_CVAR_BROADCAST : {
+			context->regs[ 0 ] = handleCvarSignal( context->regs[ 0 ], 1 );
+			break;
+		}
+		case YALNIX_RECLAIM : {
+			context->regs[ 0 ] = reclaimSync( context->regs[ 0 ] );
+			break;
+		}
+		case YALNIX_CUSTOM_0 : {
+			handleCustom( context );
+			break;
+		}
 		case YALNIX_EXIT : {
-			struct process_list * save = current_process->next;
-			handleExit( current_process->process, context->regs[ 0 ] );
-			current_process = skipIdle( save );
-			/*
-			TracePrintf( 3, "Process %d is exiting\n", current_process->process->id );
-			current_process->process->status = PROCESS_DIED;
-			*/
-			// swapProcesses( context );
-			switchTo( 0, current_process->process, context );
+			exitCurrent( context, context->regs[ 0 ] );
 			break;
 		}
 		default : {
@@ -1382,6 +3371,9 @@ static void kernelTrap( UserContext * context ){
 			break;
 		}
 	}
+
+	/* another thread may have ended the process while this one slept */
+	exitIfKilled( context );
 }
 
 /* update the counter that delayed processes have.
@@ -1424,17 +3416,16 @@ static void updateDelayedProcesses(){
 static void clockTrap( UserContext * context ){
 	TracePrintf( 6, "Clock trap\n" );
 	updateDelayedProcesses();
+	updateTimers();
 	swapProcesses( context );
+	exitIfKilled( context );
 }
 
 /* process did something illegal, kill it */
 static void illegalTrap( UserContext * context ){
 	// dummyTrap( "illegal", context );
 	printf( "Process pid %d performed an illegal operation\n", current_process->process->id );
-	struct process_list * save = current_process->next;
-	doExit( current_process->process, ERROR );
-	current_process = skipIdle( save );
-	switchTo( 0, current_process->process, context );
+	exitCurrent( context, ERROR );
 }
 
 /* return 1 if the address is probably stack growth
@@ -1450,8 +3441,22 @@ static int isStackGrowth( UserContext * context ){
 
 /* grow the stack or kill the process due to illegal memory address */
 static void memoryTrap( UserContext * context ){
+	current_process->process->usage.faults += 1;
 	TracePrintf( 6, "[%d] memory trap region 1 %p to %p. addr %p page %d stack %d base %p pc %p heap_end %p\n", current_process->process->id, VMEM_1_BASE, VMEM_1_LIMIT, context->addr, to_page( (unsigned int) context->addr, 0 ), current_process->process->stack, context->ebp, context->pc, (void *)((current_process->process->heap_end << PAGESHIFT) + VMEM_1_BASE) );
 
+	/* a write to a page that a CopyFrom or CopyTo shared. the process gets its
+	 * own copy of the page and tries again.
+	 */
+	int shared = unshareRange( current_process->process->page_table, context->addr, 1 );
+	if ( shared > 0 ){
+		return;
+	}
+	if ( shared == -1 ){
+		printf( "No memory to copy shared page at %p. Killing pid %d\n", context->addr, current_process->process->id );
+		exitCurrent( context, ERROR );
+		return;
+	}
+
 	/* if its just stack growth because the addr is close enough to sp then
 	 * grant more memory
 	 */
@@ -1462,23 +3467,25 @@ static void memoryTrap( UserContext * context ){
 		 * and another memory trap has to occur but its better to save space
 		 * in this memory starved kernel.
 		 */
+		struct process * process = current_process->process;
+		/* thread stacks have a fixed size */
+		if ( process->leader != process ||
+		     to_page( DOWN_TO_PAGE( context->addr ), 0 ) - to_page( VMEM_1_BASE, 0 ) < mainStackFloor( process ) ){
+			printf( "Stack overflow at %p. Killing pid %d\n", context->addr, process->id );
+			exitCurrent( context, ERROR );
+			return;
+		}
 		current_process->process->stack = to_page( DOWN_TO_PAGE( context->addr ), 0 );
 		if ( current_process->process->stack - to_page( VMEM_1_BASE, 0 ) < current_process->process->heap_end || 
 		     grow_stack( current_process->process->page_table, current_process->process->stack - to_page( VMEM_1_BASE, 0 ) ) ){
 			TracePrintf( 1, "Could not grow stack\n" );
-			struct process_list * save = current_process->next;
-			doExit( current_process->process, ERROR );
-			current_process = skipIdle( save );
-			switchTo( 0, current_process->process, context );
+			exitCurrent( context, ERROR );
 		} else {
 			TracePrintf( 5, "[%d] Stack grew to page %d %p. heap top %p\n", current_process->process->id, current_process->process->stack, current_process->process->stack << PAGESHIFT, (void *)((current_process->process->heap_end << PAGESHIFT) + VMEM_1_BASE) );
 		}
 	} else {
 		printf( "Invalid address %p. stack %p. Killing pid %d\n", context->addr, context->sp, current_process->process->id );
-		struct process_list * save = current_process->next;
-		doExit( current_process->process, ERROR );
-		current_process = skipIdle( save );
-		switchTo( 0, current_process->process, context );
+		exitCurrent( context, ERROR );
 	}
 }
 
@@ -1486,36 +3493,23 @@ static void memoryTrap( UserContext * context ){
 static void mathTrap( UserContext * context ){
 	dummyTrap( "math", context );
 	printf( "Process pid %d performed an illegal math operation\n", current_process->process->id );
-	struct process_list * save = current_process->next;
-	doExit( current_process->process, ERROR );
-	current_process = skipIdle( save );
-	switchTo( 0, current_process->process, context );
+	exitCurrent( context, ERROR );
 }
 
 static void ttyReceiveTrap( UserContext * context ){
 	int tty = context->code;
-	int bytes = TtyReceive( tty, terminals[ tty ].input, TERMINAL_MAX_LINE );
-	terminals[ tty ].bytes = bytes;
-	/*
-	terminals[ tty ].input[ bytes ] = 0;
-	TracePrintf( 3, "Received %d bytes from terminal %d. %s\n", bytes, tty, terminals[ tty ].input );
-	*/
+	char line[ TERMINAL_MAX_LINE ];
+	int bytes = TtyReceive( tty, line, TERMINAL_MAX_LINE );
+	int kept = queueInput( &terminals[ tty ], line, bytes );
+	if ( kept < bytes ){
+		TracePrintf( 1, "Terminal %d input is full, dropped %d bytes\n", tty, bytes - kept );
+	}
+	TracePrintf( 3, "Received %d bytes from terminal %d\n", bytes, tty );
 
-	/* find the process that is waiting to read from this tty */
-	struct process_list * list = findIOProcess( tty | TTY_READ );
+	wakeSelectors( -1, SELECT_TTY( tty ) );
 
-	/* remove process from io list, put it back on the run queue */
-	if ( list != 0 ){
-		list->prev->next = list->next;
-		if ( list->next ){
-			list->next->prev = list->prev;
-		}
-		free( list->obj );
-		list->obj = 0;
-		list->next = current_process->next;
-		list->prev = current_process;
-		current_process->next->prev = list;
-		current_process->next = list;
+	/* one reader gets the line, it wakes the next if more is left */
+	if ( wakeTtyReader( tty ) ){
 		swapProcesses( context );
 	}
 }
@@ -1531,74 +3525,38 @@ static int countProcesses( struct process_list * list ){
 }
 */
 
-/* a tty was written to so wake the process up that wrote to it.
- * Also wake up the next process waiting to write to the tty if it exists.
- * An interesting situation can occur if a process is waiting for the tty to
- * become free and the process that just wrote into the tty forks a child.
- * io1 = process that wrote to tty, about to wake up
- * io2 = process waiting for the tty to become free
- * io1child = process that io1 spawns
- *
- * So if io1 wakes up and immediately calls Fork() then io1child will be the next
- * process to run, not io2. If io1child then writes to this tty he will find tty
- * free, since io1 is done with it, and so io1child will write to the tty and wait
- * for his ttyTransmitTrap to occur. io2 in the mean time is runnable but when he wakes
- * up the tty will be suddenly busy again. This is ok because for io2 terminal->busy
- * will be 1 because io1child is using it so io2 will go back into the io list and
- * wait his turn. Obviously this can be a sort of denial of service for io2 if
- * io1child then spawns a child who does the same thing io1child did. Not that I
- * really care about such things since Fork() by itself could be used that way.
+/* a piece of output was sent. it leaves the ring, the next one goes out
+ * right away and everybody that was waiting for room in the ring tries
+ * again, in the order they came.
  */
 static void ttyTransmitTrap( UserContext * context ){
 	int tty = context->code;
+	struct tty * terminal = &terminals[ tty ];
+	struct process_list * after = current_process;
+	struct process_list * list;
 
-	struct process_list * list = findIOProcess( tty | TTY_WRITE );
-	int do_swap = 0;
+	terminal->output_start = (terminal->output_start + terminal->transmitting) % TTY_OUTPUT_SIZE;
+	terminal->output_count -= terminal->transmitting;
+	terminal->transmitting = 0;
+	startTransmit( tty );
 
-	/* if a process is around then it was waiting for io to complete */
-	if ( list != 0 ){
-		TracePrintf( 3, "[%d] Wake up from tty write to terminal %d\n", list->process->id, tty );
-		// TracePrintf( 3, "[%d] Processes in io list %d\n", list->process->id, countProcesses( io_list.next ) );
+	while ( (list = findIOProcess( tty | TTY_WRITE | TTY_WAIT )) != 0 ){
+		TracePrintf( 3, "[%d] Wake up waiting on tty write to terminal %d\n", list->process->id, tty );
 		list->prev->next = list->next;
 		if ( list->next ){
 			list->next->prev = list->prev;
 		}
 		free( list->obj );
 		list->obj = 0;
-		list->next = current_process->next;
-		list->prev = current_process;
-		current_process->next->prev = list;
-		current_process->next = list;
-		do_swap = 1;
-	} else {
-		panic( YALNIX_INVALID_PROGRAM );
-	}
-
-	/* find the next process waiting for the tty too. only one of them
-	 * needs to be woken up, as opposed to all of them, since only one
-	 * will succeed anyway.
-	 */
-	list = findIOProcess( tty | TTY_WRITE | TTY_WAIT );
-	if ( list != 0 ){
-		TracePrintf( 3, "[%d] Wake up waiting on tty write to terminal %d\n", list->process->id, tty );
-		list->prev->next = list->next;
-		if ( list->next ){
-			list->next->prev = list->prev;
-		}
-		/* we actually don't have to free the object because the
-		 * tty handler is going to use it again
-		 */
-		// free( list->obj );
-		/* insert this object after the current process */
-		struct process_list * after = current_process->next;
 		list->next = after->next;
 		list->prev = after;
 		after->next->prev = list;
 		after->next = list;
+		after = list;
 	}
 
-	if ( do_swap ){
-		swapProcesses( context );
+	if ( after != current_process ){
+		swapIfIdle( context );
 	}
 }
 
@@ -1613,13 +3571,29 @@ static void diskTrap( UserContext * context ){
 }
 /* end Yalnix traps */
 
-static int setupTrapVector(){
+/* typedef makes our lives easier */
+typedef void (*trap)( UserContext * );
+
+/* the real trap handlers, called by trapEntry */
+static trap handlers[ TRAP_VECTOR_SIZE ];
 
-	/* typedef makes our lives easier */
-	typedef void (*trap)( UserContext * );
+/* every trap goes through here so the time before the trap is charged
+ * as user time and the time in the handler as kernel time. the handler
+ * may switch processes, in which case the kernel time is charged to the
+ * process that returns to user space.
+ */
+static void trapEntry( UserContext * context ){
+	trap handler = handlers[ context->vector ];
+	chargeTime( current_process->process, &current_process->process->usage.user_time );
+	handler( context );
+	chargeTime( current_process->process, &current_process->process->usage.kernel_time );
+}
+
+static int setupTrapVector(){
 
 	/* all the traps */
 	static trap traps[ TRAP_VECTOR_SIZE ];
+	int i;
 	
 	/* read the exception vector back out to ensure nothing bad happened */
 	trap * table = NULL;
@@ -1628,14 +3602,21 @@ static int setupTrapVector(){
 	 * exception vector
 	 */
 	bzero( traps, sizeof(traps) );
-	traps[ TRAP_KERNEL ] = kernelTrap;
-	traps[ TRAP_CLOCK ] = clockTrap;
-	traps[ TRAP_ILLEGAL ] = illegalTrap;
-	traps[ TRAP_MEMORY ] = memoryTrap;
-	traps[ TRAP_MATH ] = mathTrap;
-	traps[ TRAP_TTY_RECEIVE ] = ttyReceiveTrap;
-	traps[ TRAP_TTY_TRANSMIT ] = ttyTransmitTrap;
-	traps[ TRAP_DISK ] = diskTrap;
+	bzero( handlers, sizeof(handlers) );
+	handlers[ TRAP_KERNEL ] = kernelTrap;
+	handlers[ TRAP_CLOCK ] = clockTrap;
+	handlers[ TRAP_ILLEGAL ] = illegalTrap;
+	handlers[ TRAP_MEMORY ] = memoryTrap;
+	handlers[ TRAP_MATH ] = mathTrap;
+	handlers[ TRAP_TTY_RECEIVE ] = ttyReceiveTrap;
+	handlers[ TRAP_TTY_TRANSMIT ] = ttyTransmitTrap;
+	handlers[ TRAP_DISK ] = diskTrap;
+
+	for ( i = 0; i < TRAP_VECTOR_SIZE; i++ ){
+		if ( handlers[ i ] != 0 ){
+			traps[ i ] = trapEntry;
+		}
+	}
 
 	WriteRegister( REG_VECTOR_BASE, (unsigned int) traps );
 
@@ -1744,8 +3725,11 @@ KernelContext * swapKernel( KernelContext *kContext, void * from_pcb, void * to_
 static void initializeTerminals(){
 	int i;
 	for ( i = 0; i < NUM_TERMINALS; i++ ){
-		terminals[ i ].bytes = -1;
-		terminals[ i ].busy = 0;
+		terminals[ i ].input_start = 0;
+		terminals[ i ].input_count = 0;
+		terminals[ i ].output_start = 0;
+		terminals[ i ].output_count = 0;
+		terminals[ i ].transmitting = 0;
 	}
 }
 
@@ -1794,18 +3778,7 @@ void KernelStart( char ** args, unsigned int memorySize, UserContext * context )
 
 	initializeTerminals();
 
-	/* original kernel context for new processes */
-	static KernelContext kernel_context;
-	/* original kernel stack for new processes */
-	static char * stack;
 	static int setup = 0;
-	/* it would be nice to use get_pages(2) so that I can use copyPage later on */
-	stack = malloc( PAGESIZE * 2 );
-	if ( ! stack ){
-		panic( YALNIX_OUT_OF_MEMORY );
-	}
-	bzero( &kernel_context, sizeof(kernel_context) );
-	bzero( stack, PAGESIZE * 2 );
 
 	// testKernelHeap();
 
@@ -1815,30 +3788,24 @@ void KernelStart( char ** args, unsigned int memorySize, UserContext * context )
 	setIdleProcess( idle );
 	// run_list.process = idle;
 
+	/* programs in the bundle are read without opening and parsing each file */
+	openBundle( BUNDLE_FILE );
+
 	loadCommandLinePrograms( args );
 
 	setup = 0;
 
 	/* each process will start from here when it is first context switched to life */
-	getCurrentKernelContext( &kernel_context, stack );
+	KernelContextSwitch( KContextStart, getRunList(), &ret );
 
 	/* only set the initial kernel context and stack one time before the very first
 	 * process starts running.
 	 */
 	if ( !setup ){
-		struct process_list * list = getRunList();
 		setup = 1;
-		do{
-			struct process * p = list->process;
-			p->kernel_context = kernel_context;
-			TracePrintf( 5, "Copy stack to pid %d\n", p->id );
-			ret = copyStack( p->kernel_stack, stack );
-			if ( ret != YALNIX_NO_ERROR ){
-				panic( ret );
-			}
-			list = list->next;
-		} while ( list != getRunList() );
-		free( stack );
+		if ( ret != YALNIX_NO_ERROR ){
+			panic( ret );
+		}
 		switchTo( 0, current_process->process, context );
 	}
 	TracePrintf( 8, "First switch to process %d\n", current_process->process->id );
@@ -16,6 +16,8 @@
 #include "memory.h"
 #include "kernel.h"
 #include "yalnix.h"
+#include "image.h"
+#include "bundle.h"
 
 static int countPages( struct memory_page ** table, int max ){
 	int i = 0;
@@ -59,6 +61,8 @@ int loadProgram( struct process * process, char *name, char *args[] ){
 	long segment_size;
 	char *argbuf;
 	char * argbuf_malloc;
+	struct image * image;
+	struct bundle_entry * bundled = 0;
 	int error = YALNIX_NO_ERROR;
 
 	/* cleanup is a bitmask of things to clean up so we don't need separate goto's.
@@ -74,22 +78,35 @@ int loadProgram( struct process * process, char *name, char *args[] ){
 	const int CLEANUP_FD = 0x1;
 	/* free argbuf buffer */
 	const int CLEANUP_ARGBUF = 0x2;
+	/* let the image cache evict the image again */
+	const int CLEANUP_IMAGE = 0x4;
 	int cleanup = 0;
 
 	/*
-	 * Open the executable file 
+	 * Use the cached copy of the program if the file didn't change,
+	 * then the boot bundle, otherwise open the executable file 
 	 */
-	if ((fd = open(name, O_RDONLY)) < 0) {
-		TracePrintf(0, "LoadProgram: can't open file '%s'\n", name);
-		error = ERROR;
-		goto fail;
-	}
-	cleanup |= CLEANUP_FD;
+	image = findImage( name );
+	if ( image ){
+		li = image->info;
+		/* the image must stay around until it is copied */
+		image->busy = 1;
+		cleanup |= CLEANUP_IMAGE;
+	} else if ( (bundled = findBundle( name )) != 0 ){
+		li = bundled->info;
+	} else {
+		if ((fd = open(name, O_RDONLY)) < 0) {
+			TracePrintf(0, "LoadProgram: can't open file '%s'\n", name);
+			error = ERROR;
+			goto fail;
+		}
+		cleanup |= CLEANUP_FD;
 
-	if (LoadInfo(fd, &li) != LI_NO_ERROR) {
-		TracePrintf(0, "LoadProgram: '%s' not in Yalnix format\n", name);
-		error = ERROR;
-		goto fail;
+		if (LoadInfo(fd, &li) != LI_NO_ERROR) {
+			TracePrintf(0, "LoadProgram: '%s' not in Yalnix format\n", name);
+			error = ERROR;
+			goto fail;
+		}
 	}
 
 	if (li.entry < VMEM_1_BASE) {
@@ -226,10 +243,11 @@ int loadProgram( struct process * process, char *name, char *args[] ){
 	/* clear out existing pages */
 	for ( i = 0; i < process->pages; i++ ){
 		if ( process->page_table[ i ] != 0 ){
-			add_free_page( process->page_table[ i ] );
+			release_page( process->page_table[ i ] );
 		}
 	}
 	bzero( process->page_table, sizeof( struct memory_page * ) * process->pages );
+	process->shared_pages = 0;
 
 	/*
 	 * Allocate "li.t_npg" physical pages and map them starting at
@@ -295,32 +313,62 @@ int loadProgram( struct process * process, char *name, char *args[] ){
 
 	TracePrintf( 8, "Setup page tables\n" );
 
-	/*
-	 * Read the text from the file into memory.
-	 */
-	lseek(fd, li.t_faddr, SEEK_SET);
-	segment_size = li.t_npg << PAGESHIFT;
-	TracePrintf( 6, "Read at %p Segment size %p\n", li.t_vaddr, segment_size );
-	if (read(fd, (void *) li.t_vaddr, segment_size) != segment_size) {
+	if ( image ){
 		/*
-		==>> KILL is not defined anywhere: it is an error code distinct
-		==>> from ERROR because it requires different action in the caller.
-		==>> Since this error code is internal to your kernel, you get to define it.
-		*/
+		 * Copy the text and data from the cached image.
+		 */
+		if ( copyImage( image ) != YALNIX_NO_ERROR ){
+			error = YALNIX_INVALID_PROGRAM;
+			goto fail;
+		}
+		image->busy = 0;
+		cleanup &= ~CLEANUP_IMAGE;
+	} else if ( bundled ){
+		/*
+		 * Read the text and data that were laid out in the bundle.
+		 */
+		if ( readBundle( bundled ) != YALNIX_NO_ERROR ){
+			error = YALNIX_INVALID_PROGRAM;
+			goto fail;
+		}
 
-		error = YALNIX_INVALID_PROGRAM;
-		goto fail;
-	}
+		/* the next Exec of it comes from memory like any other program */
+		cacheBundledImage( name, bundled->size, bundled->modified, &li );
+	} else {
+		/*
+		 * Read the text from the file into memory.
+		 */
+		lseek(fd, li.t_faddr, SEEK_SET);
+		segment_size = li.t_npg << PAGESHIFT;
+		TracePrintf( 6, "Read at %p Segment size %p\n", li.t_vaddr, segment_size );
+		if (read(fd, (void *) li.t_vaddr, segment_size) != segment_size) {
+			/*
+			==>> KILL is not defined anywhere: it is an error code distinct
+			==>> from ERROR because it requires different action in the caller.
+			==>> Since this error code is internal to your kernel, you get to define it.
+			*/
+
+			error = YALNIX_INVALID_PROGRAM;
+			goto fail;
+		}
 
-	/*
-	 * Read the data from the file into memory.
-	 */
-	lseek(fd, li.id_faddr, 0);
-	segment_size = li.id_npg << PAGESHIFT;
+		/*
+		 * Read the data from the file into memory.
+		 */
+		lseek(fd, li.id_faddr, 0);
+		segment_size = li.id_npg << PAGESHIFT;
 
-	if (read(fd, (void *) li.id_vaddr, segment_size) != segment_size) {
-		error = YALNIX_INVALID_PROGRAM;
-		goto fail;
+		if (read(fd, (void *) li.id_vaddr, segment_size) != segment_size) {
+			error = YALNIX_INVALID_PROGRAM;
+			goto fail;
+		}
+
+		/* keep the text and data around for the next time this program runs */
+		cacheImage( name, fd, &li );
+
+		/* we've read it all now */
+		close( fd );
+		cleanup &= ~CLEANUP_FD;
 	}
 
 	/*
@@ -347,10 +395,6 @@ int loadProgram( struct process * process, char *name, char *args[] ){
 		modifyPageTable1( page->virtual, 1, page->protection, page->frame );
 	}
 
-	/* we've read it all now */
-	close( fd );
-	cleanup &= ~CLEANUP_FD;
-
 	/*
 	 * Zero out the uninitialized data area
 	 */
@@ -400,6 +444,9 @@ int loadProgram( struct process * process, char *name, char *args[] ){
 	if ( cleanup & CLEANUP_ARGBUF ){
 		free( argbuf_malloc );
 	}
+	if ( cleanup & CLEANUP_IMAGE ){
+		image->busy = 0;
+	}
 
 	return error;
 }
@@ -2,6 +2,7 @@
 #include "hardware.h"
 #include "memory.h"
 #include "debug.h"
+#include "image.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -14,6 +15,17 @@ static void * top_of_kernel_heap = 0;
 static void * bottom_of_kernel_heap = 0;
 static int virtual_memory_enabled = 0;
 
+/* the page table that is mapped in region 1 right now */
+static struct memory_page ** region1_table = 0;
+
+/* kernel stacks of exited processes. new processes take their stack
+ * from here before going to the free list. the pool is drained back into
+ * the free list when the free list runs out.
+ */
+#define KERNEL_STACK_POOL 4
+static struct memory_page * kernel_stack_pool[ KERNEL_STACK_POOL ][ KERNEL_STACK_PAGES ];
+static int kernel_stack_pool_size = 0;
+
 /* flush TLB for region 0 */
 void flushTLB0(){
 	WriteRegister( REG_TLB_FLUSH, TLB_FLUSH_0 );
@@ -184,8 +196,13 @@ static int checkTable( void * data, int check, int protection ){
 	return 1;
 }
 
-/* 1 if [p, p+size) is inside region 1, 0 otherwise */
+/* 1 if [p, p+size) is inside region 1, 0 otherwise. shared pages are
+ * copied first when asking for write access so the kernel can write to them.
+ */
 static int ensureRegion1( void * p, int size, int protection ){
+	if ( (protection & PROT_WRITE) && region1_table != 0 && unshareRange( region1_table, p, size ) == -1 ){
+		return 0;
+	}
 	return ensure( p, size, protection, (void *) &region1_page_table, checkRegion1 );	
 }
 
@@ -239,14 +256,37 @@ static int countPages( struct memory_page * page ){
 }
 */
 
+/* put all pooled kernel stacks back on the free list */
+static void drainKernelStackPool(){
+	int i;
+	while ( kernel_stack_pool_size > 0 ){
+		kernel_stack_pool_size -= 1;
+		for ( i = 0; i < KERNEL_STACK_PAGES; i++ ){
+			add_free_page( kernel_stack_pool[ kernel_stack_pool_size ][ i ] );
+		}
+	}
+}
+
 /* returns a free *physical* page from the free list of memory */
 struct memory_page * get_free_page(){
 	struct memory_page * page;
 
+	if ( memory_page_free.next == 0 && kernel_stack_pool_size > 0 ){
+		TracePrintf( 10, "Drain kernel stack pool\n" );
+		drainKernelStackPool();
+	}
+
+	/* cached program images are the next thing to go */
+	while ( memory_page_free.next == 0 && evictImage() ){
+		/**/
+	}
+
 	if ( memory_page_free.next != 0 ){
 		page = memory_page_free.next;	
 		memory_page_free.next = memory_page_free.next->next;
 		TracePrintf( 10, "Use free page %d\n", page->frame );
+		page->refs = 1;
+		page->shared = 0;
 	} else {
 		TracePrintf( 10, "No more free physical pages\n" );
 		return 0;
@@ -268,9 +308,160 @@ void add_free_page( struct memory_page * page ){
 	memory_page_free.next = page;
 }
 
-/* returns 1 if there are at least i pages of memory available */
+/* give up one page table's use of a page. the frame goes back to the free
+ * list when no page table maps it anymore.
+ */
+void release_page( struct memory_page * page ){
+	page->refs -= 1;
+	if ( page->refs <= 0 ){
+		add_free_page( page );
+	}
+}
+
+/* protection for page in the hardware table. frames shared by CopyFrom or
+ * CopyTo are read only, MapShared frames are not.
+ */
+static int hardwareProtection( struct memory_page * page ){
+	if ( page->refs > 1 && ! page->shared ){
+		return page->protection & ~PROT_WRITE;
+	}
+	return page->protection;
+}
+
+/* rewrite entry index of region 1 after the page or its sharing changed */
+static void refreshPage1( int index, struct memory_page * page ){
+	modifyPageTable1( index, 1, hardwareProtection( page ), page->frame );
+	WriteRegister( REG_TLB_FLUSH, VMEM_1_BASE + (index << PAGESHIFT) );
+}
+
+/* map the frame of src[ src_index ] at dest[ dest_index ] too instead of
+ * copying it. whatever dest had there is released. both tables see the
+ * same bytes until one of them writes to the page.
+ */
+void sharePage( struct memory_page ** dest, int dest_index, struct memory_page ** src, int src_index ){
+	struct memory_page * page = src[ src_index ];
+	if ( dest[ dest_index ] == page ){
+		return;
+	}
+	if ( dest[ dest_index ] != 0 ){
+		release_page( dest[ dest_index ] );
+	}
+	page->refs += 1;
+	dest[ dest_index ] = page;
+
+	/* either table might be in use. the TLB could still allow writes */
+	if ( src == region1_table ){
+		refreshPage1( src_index, page );
+	}
+	if ( dest == region1_table ){
+		refreshPage1( dest_index, page );
+	}
+}
+
+/* give table its own copy of a shared page so it can be written.
+ * returns 0 on success or -1 if there is no memory for the copy.
+ */
+int unsharePage( struct memory_page ** table, int index ){
+	struct memory_page * page = table[ index ];
+	if ( page->refs > 1 ){
+		struct memory_page * copy = get_free_page();
+		int virtual;
+		if ( copy == 0 ){
+			TracePrintf( 2, "No free pages to copy shared page %d\n", index );
+			return -1;
+		}
+		virtual = mapUnusedPage0( page->frame, -1 );
+		if ( virtual == -1 ){
+			release_page( copy );
+			return -1;
+		}
+		if ( copyBlockToPage( copy, (char *)(virtual << PAGESHIFT), PAGESIZE ) != YALNIX_NO_ERROR ){
+			unMapPage0( virtual );
+			release_page( copy );
+			return -1;
+		}
+		unMapPage0( virtual );
+		TracePrintf( 8, "Copy shared frame %d to %d for page %d\n", page->frame, copy->frame, index );
+		copy->virtual = index;
+		copy->protection = page->protection;
+		page->refs -= 1;
+		table[ index ] = copy;
+		page = copy;
+	}
+
+	/* the last sharer might still have a read only entry */
+	if ( table == region1_table ){
+		refreshPage1( index, page );
+	}
+	return 0;
+}
+
+/* unshare every writable page of table that [p, p+size) touches and that
+ * can't be written right now. returns how many pages had to be fixed or
+ * -1 if there was no memory.
+ */
+int unshareRange( struct memory_page ** table, void * p, int size ){
+	int base = to_page( VMEM_1_BASE, 0 );
+	int first = to_page( (unsigned int) p, 0 ) - base;
+	int last = to_page( (unsigned int)(p + size - 1), 0 ) - base;
+	int fixed = 0;
+	int i;
+
+	if ( size <= 0 ){
+		return 0;
+	}
+	if ( first < 0 ){
+		first = 0;
+	}
+	if ( last >= region1_pages ){
+		last = region1_pages - 1;
+	}
+	for ( i = first; i <= last; i++ ){
+		struct memory_page * page = table[ i ];
+		if ( page == 0 || ! (page->protection & PROT_WRITE) || page->shared ){
+			continue;
+		}
+		if ( page->refs > 1 ||
+		     (table == region1_table && ! (region1_page_table[ i ].prot & PROT_WRITE)) ){
+			if ( unsharePage( table, i ) == -1 ){
+				return -1;
+			}
+			fixed += 1;
+		}
+	}
+	return fixed;
+}
+
+/* fill stack with a kernel stack from the pool.
+ * returns 1 on success or 0 if the pool is empty.
+ */
+int get_kernel_stack( struct memory_page ** stack ){
+	if ( kernel_stack_pool_size == 0 ){
+		return 0;
+	}
+	kernel_stack_pool_size -= 1;
+	memcpy( stack, kernel_stack_pool[ kernel_stack_pool_size ], sizeof( struct memory_page * ) * KERNEL_STACK_PAGES );
+	return 1;
+}
+
+/* keep the pages of a kernel stack for the next process.
+ * returns 1 if the stack was pooled or 0 if the pool is full.
+ */
+int add_kernel_stack( struct memory_page ** stack ){
+	if ( kernel_stack_pool_size == KERNEL_STACK_POOL ){
+		return 0;
+	}
+	memcpy( kernel_stack_pool[ kernel_stack_pool_size ], stack, sizeof( struct memory_page * ) * KERNEL_STACK_PAGES );
+	kernel_stack_pool_size += 1;
+	return 1;
+}
+
+/* returns 1 if there are at least i pages of memory available.
+ * pooled kernel stacks and cached images count as free since get_free_page
+ * will use them.
+ */
 int freePages( int i ){
-	int count = 0;
+	int count = kernel_stack_pool_size * KERNEL_STACK_PAGES + imageCachePages();
 	struct memory_page * page = memory_page_free.next;
 	while ( count < i && page != 0 ){
 		count += 1;
@@ -333,8 +524,8 @@ int user_brk( struct memory_page ** pages, int heap_start, int heap_end, void *
 		/* deallocate some pages of memory */
 		int i;
 		for ( i = memory_page + 1; i < heap_end; i++ ){
-			add_free_page( pages[ i ] );
 			modifyPageTable1( i, 0, pages[ i ]->protection, pages[ i ]->frame );
+			release_page( pages[ i ] );
 			pages[ i ] = 0;
 		}
 	}
@@ -407,6 +598,47 @@ YalnixError copyBlockToPage( struct memory_page * page, char * block, int size )
 	return YALNIX_NO_ERROR;
 }
 
+/* map the page to some virtual frame and copy size bytes from it to block.
+ * then unmap the page
+ */
+YalnixError copyPageToBlock( struct memory_page * page, char * block, int size ){
+	int virtual = mapUnusedPage0( page->frame, -1 );
+	if ( virtual == -1 ){
+		TracePrintf( 0, "Could not allocate memory for page copy\n" );
+		return YALNIX_NO_FREE_VIRTUAL_PAGES;
+	}
+	memcpy( block, (void *)(virtual << PAGESHIFT), size );
+	unMapPage0( virtual );
+	return YALNIX_NO_ERROR;
+}
+
+/* fill the page with zeros */
+YalnixError clearPage( struct memory_page * page ){
+	int virtual = mapUnusedPage0( page->frame, -1 );
+	if ( virtual == -1 ){
+		TracePrintf( 0, "Could not allocate memory to clear a page\n" );
+		return YALNIX_NO_FREE_VIRTUAL_PAGES;
+	}
+	bzero( (void *)(virtual << PAGESHIFT), PAGESIZE );
+	unMapPage0( virtual );
+	return YALNIX_NO_ERROR;
+}
+
+/* copy the kernel stack that is in use right now into the frames of stack.
+ * only call this from a KernelContextSwitch helper so the copy matches the
+ * kernel context that is saved along with it.
+ */
+YalnixError copyKernelStack( struct memory_page ** stack ){
+	int i;
+	for ( i = 0; i < KERNEL_STACK_PAGES; i++ ){
+		YalnixError error = copyBlockToPage( stack[ i ], (char *) KERNEL_STACK_BASE + PAGESIZE * i, PAGESIZE );
+		if ( error != YALNIX_NO_ERROR ){
+			return error;
+		}
+	}
+	return YALNIX_NO_ERROR;
+}
+
 /* map the kernel stack to pages just below the real kernel stack, 0x7e and 0x7f,
  * then memcpy the new kernel stack to those pages
  *
@@ -438,15 +670,17 @@ void setupKernelStack( struct memory_page ** stack, int num_pages ){
 	*/
 }
 
-/* map valid pages from 'table' in region 1 */
+/* map valid pages from 'table' in region 1. entry i always maps page i
+ * since a shared page only remembers one of its virtual numbers.
+ */
 void setupPageTable( struct memory_page ** table, int size ){
 	int i;
+	region1_table = table;
 	for ( i = 0; i < size; i++ ){
 		int valid = table[ i ] != 0;
 		int frame = table[ i ] != 0 ? table[ i ]->frame : 0;
-		int protection = table[ i ] != 0 ? table[ i ]->protection : PROT_READ;
-		int virtual = table[ i ] != 0 ? table[ i ]->virtual : i;
-		modifyPageTable1( virtual, valid, protection, frame );
+		int protection = table[ i ] != 0 ? hardwareProtection( table[ i ] ) : PROT_READ;
+		modifyPageTable1( i, valid, protection, frame );
 	}
 
 	flushTLB1();
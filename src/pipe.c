@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pipe.h"
+#include "debug.h"
+
+/* a handle is an index into this table */
+static struct pipe * pipes[ MAX_PIPES ];
+
+/* make an empty pipe for process creator and return its handle, or ERROR
+ * if there are too many pipes or no memory
+ */
+int createPipe( int creator ){
+	struct pipe * pipe;
+	int handle;
+	for ( handle = 0; handle < MAX_PIPES && pipes[ handle ] != 0; handle++ ){
+	}
+	if ( handle == MAX_PIPES ){
+		return ERROR;
+	}
+
+	pipe = (struct pipe *) malloc( sizeof( struct pipe ) );
+	if ( ! pipe ){
+		return ERROR;
+	}
+	pipe->start = 0;
+	pipe->count = 0;
+	pipe->readers = 0;
+	pipe->writers = 0;
+	pipe->creator = creator;
+	pipe->read_waiters = (struct wait_queue){ .first = 0, .last = 0 };
+	pipe->write_waiters = (struct wait_queue){ .first = 0, .last = 0 };
+
+	pipes[ handle ] = pipe;
+	TracePrintf( 5, "Created pipe %d\n", handle );
+	return handle;
+}
+
+struct pipe * findPipe( int handle ){
+	if ( handle < 0 || handle >= MAX_PIPES ){
+		return 0;
+	}
+	return pipes[ handle ];
+}
+
+void freePipe( int handle ){
+	TracePrintf( 5, "Free pipe %d\n", handle );
+	free( pipes[ handle ] );
+	pipes[ handle ] = 0;
+}
+
+/* take a process that is going away off the queues of every pipe */
+void forgetPipeWaiter( struct process * process ){
+	int handle;
+	for ( handle = 0; handle < MAX_PIPES; handle++ ){
+		if ( pipes[ handle ] != 0 ){
+			removeWaiter( &pipes[ handle ]->read_waiters, process );
+			removeWaiter( &pipes[ handle ]->write_waiters, process );
+		}
+	}
+}
+
+/* move up to length unread bytes into data. returns how many were moved */
+int pipeRead( struct pipe * pipe, char * data, int length ){
+	int total = 0;
+	while ( total < length && pipe->count > 0 ){
+		/* the unread bytes may wrap around the end of the buffer */
+		int chunk = PIPE_SIZE - pipe->start;
+		if ( chunk > pipe->count ){
+			chunk = pipe->count;
+		}
+		if ( chunk > length - total ){
+			chunk = length - total;
+		}
+		memcpy( data + total, pipe->buffer + pipe->start, chunk );
+		pipe->start = (pipe->start + chunk) % PIPE_SIZE;
+		pipe->count -= chunk;
+		total += chunk;
+	}
+	return total;
+}
+
+/* append as much of data as fits. returns how many bytes were taken */
+int pipeWrite( struct pipe * pipe, char * data, int length ){
+	int total = 0;
+	while ( total < length && pipe->count < PIPE_SIZE ){
+		int end = (pipe->start + pipe->count) % PIPE_SIZE;
+		int chunk = end >= pipe->start ? PIPE_SIZE - end : pipe->start - end;
+		if ( chunk > length - total ){
+			chunk = length - total;
+		}
+		memcpy( pipe->buffer + end, data + total, chunk );
+		pipe->count += chunk;
+		total += chunk;
+	}
+	return total;
+}
@@ -3,64 +3,72 @@
 #include "process.h"
 #include "memory.h"
 
+/* free a linked list of status's */
+static void freeStatusList( struct status_list * next ){
+	while ( next != 0 ){
+		struct status_list * save = next->next;
+		free( next );
+		next = save;
+	}
+}
+
 /* free resources used by a process including
  * - kernel stack
- * - page table array
+ * - page table array, unless the process is a thread
  * - process struct itself
  */
 void freeProcess( struct process * process ){
 	int i;
-	struct status_list * next = process->terminated.next;
-	while ( next != 0 ){
-		struct status_list * save = next->next;
-		free( next );
-		next = save;
-	}
-	for ( i = 0; i < KERNEL_STACK_PAGES; i++ ){
-		if ( process->kernel_stack[ i ] != 0 ){
-			add_free_page( process->kernel_stack[ i ] );
+	freeStatusList( process->terminated.next );
+	freeStatusList( process->thread_exits.next );
+	free( process->mailbox );
+	/* a complete kernel stack goes to the pool for the next process */
+	if ( process->kernel_stack[ KERNEL_STACK_PAGES - 1 ] == 0 || ! add_kernel_stack( process->kernel_stack ) ){
+		for ( i = 0; i < KERNEL_STACK_PAGES; i++ ){
+			if ( process->kernel_stack[ i ] != 0 ){
+				add_free_page( process->kernel_stack[ i ] );
+			}
 		}
 	}
-	for ( i = 0; i < process->pages; i++ ){
-		if ( process->page_table[ i ] != 0 ){
-			add_free_page( process->page_table[ i ] );
+	/* threads share the page table of their leader */
+	if ( process->leader == process ){
+		for ( i = 0; i < process->pages; i++ ){
+			if ( process->page_table[ i ] != 0 ){
+				release_page( process->page_table[ i ] );
+			}
 		}
+		free( process->page_table );
 	}
-	free( process->children );
-	free( process->page_table );
 	free( process );
 }
 
-/* insert child into a free space in the parent's children array.
- * the array will grow dynamically if it is too small
- */
-int addChildToProcess( struct process * parent, struct process * child ){
-	int index = 0;
-	/* find a free index in the array */
-	for ( index = 0; index < parent->max_children && parent->children[ index ] != 0 ; index++ ){
-		/**/
-	}
-
-	/* if none were found then grow the array by doubling it */
-	if ( index == parent->max_children ){
-		struct process ** bigger;
-		int old_size = parent->max_children;
-		parent->max_children *= 2;
-		bigger = (struct process **) malloc( sizeof(struct process *) * parent->max_children );
-		if ( ! bigger ){
-			parent->max_children = old_size;
-			return ERROR;
-		}
-		bzero( bigger, sizeof(struct process *) * parent->max_children );
-		memcpy( bigger, parent->children, sizeof(struct process *) * old_size );
-		free( parent->children );
-		parent->children = bigger;
-	}
-
+/* link child into the front of the parent's list of children */
+void addChildToProcess( struct process * parent, struct process * child ){
 	TracePrintf( 3, "Add child %d to parent %d\n", child->id, parent->id );
-	parent->children[ index ] = child;
+	child->parent = parent;
+	child->prev_sibling = 0;
+	child->next_sibling = parent->first_child;
+	if ( parent->first_child ){
+		parent->first_child->prev_sibling = child;
+	}
+	parent->first_child = child;
+	parent->live_children += 1;
+}
 
-	return 0;
+/* unlink child from the parent's list of children */
+void removeChildFromProcess( struct process * parent, struct process * child ){
+	if ( child->prev_sibling ){
+		child->prev_sibling->next_sibling = child->next_sibling;
+	} else {
+		parent->first_child = child->next_sibling;
+	}
+	if ( child->next_sibling ){
+		child->next_sibling->prev_sibling = child->prev_sibling;
+	}
+	child->next_sibling = 0;
+	child->prev_sibling = 0;
+	child->parent = 0;
+	parent->live_children -= 1;
 }
 
 /* create an empty process structure
@@ -88,18 +96,47 @@ struct process * createProcess(void){
 	process->parent = 0;
 	
 	process->terminated = (struct status_list){ .status = 0, .id = 0, .next = 0 };
+	process->last_terminated = &process->terminated;
+	process->wait_for = -1;
 
-	process->max_children = 10;
-	process->children = (struct process **) malloc( sizeof( struct process * ) * process->max_children );
-	if ( ! process->children ){
-		free( process );
-		return 0;
-	}
-	bzero( process->children, sizeof( struct process * ) * process->max_children );
+	process->first_child = 0;
+	process->next_sibling = 0;
+	process->prev_sibling = 0;
+	process->live_children = 0;
+
+	process->leader = process;
+	process->first_thread = 0;
+	process->next_thread = 0;
+	process->threads = 0;
+	process->thread_slots = 0;
+	process->thread_slot = -1;
+	process->joiner = 0;
+	process->thread_exits = (struct status_list){ .status = 0, .id = 0, .next = 0 };
+	process->exit_code = 0;
+	process->killed = 0;
+
+	process->next_waiter = 0;
+	process->futex_key = 0;
+
+	process->pipe_in = -1;
+	process->pipe_out = -1;
+
+	process->mailbox = 0;
+	process->cvar_lock = -1;
+	process->next_timer = 0;
+	process->timer = 0;
+	process->timed_out = 0;
+	process->select_events = 0;
+	process->shared_pages = 0;
+	process->doorbell = 0;
+
+	bzero( &process->usage, sizeof( process->usage ) );
+	bzero( &process->ipc_stats, sizeof( process->ipc_stats ) );
+	bzero( &process->child_usage, sizeof( process->child_usage ) );
+	process->usage_mark = 0;
 
 	process->page_table = (struct memory_page **) malloc( sizeof( struct memory_page * ) * process->pages );
 	if ( ! process->page_table ){
-		free( process->children );
 		free( process );
 		return 0;
 	}
@@ -107,7 +144,10 @@ struct process * createProcess(void){
 
 	bzero( process->kernel_stack, sizeof( struct memory_page *) * KERNEL_STACK_PAGES );
 
-	/* kernel stack */
+	/* kernel stack, reuse one from an exited process if possible */
+	if ( get_kernel_stack( process->kernel_stack ) ){
+		return process;
+	}
 	for ( i = 0; i < KERNEL_STACK_PAGES; i++ ){
 		process->kernel_stack[ i ] = get_free_page();
 		if ( ! process->kernel_stack[ i ] ){
@@ -119,3 +159,193 @@ struct process * createProcess(void){
 
 	return process;
 }
+
+/* first page, relative to the start of region 1, above the stack of
+ * thread stack slot 'slot'
+ */
+int threadStackTop( int slot ){
+	return region1_pages - THREAD_MAIN_STACK_PAGES - slot * (THREAD_STACK_PAGES + 1);
+}
+
+/* lowest page, relative to the start of region 1, that the main stack
+ * of leader can grow down to
+ */
+int mainStackFloor( struct process * leader ){
+	if ( leader->thread_slots != 0 ){
+		return region1_pages - THREAD_MAIN_STACK_PAGES;
+	}
+	if ( leader->shared_pages != 0 ){
+		return sharedWindowBase() + SHARED_PAGES + 1;
+	}
+	return leader->heap_end;
+}
+
+/* the heap of leader has to stay below this page, relative to the start of
+ * region 1. that is the guard page of the lowest thread stack or the bottom
+ * of the main stack.
+ */
+int heapCeiling( struct process * leader ){
+	int slot;
+	if ( leader->shared_pages != 0 ){
+		return sharedWindowBase() - 1;
+	}
+	for ( slot = MAX_THREADS - 1; slot >= 0; slot-- ){
+		if ( leader->thread_slots & (1 << slot) ){
+			return threadStackTop( slot ) - THREAD_STACK_PAGES - 1;
+		}
+	}
+	return leader->stack - to_page( VMEM_1_BASE, 0 );
+}
+
+/* first page of the MapShared window, relative to the start of region 1 */
+int sharedWindowBase(){
+	return threadStackTop( MAX_THREADS - 1 ) - THREAD_STACK_PAGES - 1 - SHARED_PAGES;
+}
+
+/* unmap and free the stack pages of a thread slot from 'start' up to 'end'.
+ * the leader's page table has to be the one in use.
+ */
+static void releaseThreadStack( struct process * leader, int start, int end ){
+	int i;
+	for ( i = start; i < end; i++ ){
+		if ( leader->page_table[ i ] != 0 ){
+			modifyPageTable1( i, 0, 0, 0 );
+			release_page( leader->page_table[ i ] );
+			leader->page_table[ i ] = 0;
+		}
+	}
+	flushTLB1();
+}
+
+/* create a thread that shares the page table of leader. the thread gets
+ * the first free stack slot, which is mapped into region 1 right away so
+ * the leader's page table has to be the one in use.
+ * returns 0 if there are no free slots, the slot would collide with the heap
+ * or main stack, or there is not enough memory.
+ */
+struct process * createThread( struct process * leader ){
+	struct process * thread;
+	int slot;
+	int top;
+	int i;
+
+	for ( slot = 0; slot < MAX_THREADS && (leader->thread_slots & (1 << slot)); slot++ ){
+	}
+	if ( slot == MAX_THREADS ){
+		TracePrintf( 3, "[%d] No free thread slots\n", leader->id );
+		return 0;
+	}
+
+	top = threadStackTop( slot );
+	/* the heap has to stay below the guard page and the main stack above
+	 * the thread slots
+	 */
+	if ( leader->heap_end > top - THREAD_STACK_PAGES - 1 ||
+	     leader->stack - to_page( VMEM_1_BASE, 0 ) < region1_pages - THREAD_MAIN_STACK_PAGES ){
+		TracePrintf( 3, "[%d] Thread stack %d collides with the heap or stack\n", leader->id, slot );
+		return 0;
+	}
+
+	thread = createProcess();
+	if ( ! thread ){
+		return 0;
+	}
+
+	free( thread->page_table );
+	thread->page_table = leader->page_table;
+	thread->pages = leader->pages;
+	thread->leader = leader;
+	thread->thread_slot = slot;
+
+	for ( i = top - THREAD_STACK_PAGES; i < top; i++ ){
+		struct memory_page * page = get_free_page();
+		if ( ! page ){
+			TracePrintf( 3, "[%d] No free pages for thread stack\n", leader->id );
+			releaseThreadStack( leader, top - THREAD_STACK_PAGES, i );
+			freeProcess( thread );
+			return 0;
+		}
+		page->virtual = i;
+		page->protection = PROT_READ | PROT_WRITE;
+		modifyPageTable1( i, 1, page->protection, page->frame );
+		leader->page_table[ i ] = page;
+	}
+	thread->stack = to_page( VMEM_1_BASE, 0 ) + top - THREAD_STACK_PAGES;
+
+	thread->next_thread = leader->first_thread;
+	leader->first_thread = thread;
+	leader->threads += 1;
+	leader->thread_slots |= 1 << slot;
+
+	return thread;
+}
+
+/* unlink thread from its leader and give back its stack pages.
+ * the leader's page table has to be the one in use.
+ */
+void removeThreadFromProcess( struct process * leader, struct process * thread ){
+	struct process ** link = &leader->first_thread;
+	int top = threadStackTop( thread->thread_slot );
+
+	while ( *link != 0 && *link != thread ){
+		link = &(*link)->next_thread;
+	}
+	if ( *link == thread ){
+		*link = thread->next_thread;
+	}
+	thread->next_thread = 0;
+
+	releaseThreadStack( leader, top - THREAD_STACK_PAGES, top );
+	leader->thread_slots &= ~(1 << thread->thread_slot);
+	leader->threads -= 1;
+}
+
+/* queue an asynchronous message for leader. returns 0 or ERROR if the
+ * mailbox is full or could not be made.
+ */
+int putMail( struct process * leader, int from, char * message ){
+	struct mail * mail;
+	if ( ! leader->mailbox ){
+		leader->mailbox = (struct mailbox *) malloc( sizeof( struct mailbox ) );
+		if ( ! leader->mailbox ){
+			return ERROR;
+		}
+		leader->mailbox->start = 0;
+		leader->mailbox->count = 0;
+	}
+	if ( leader->mailbox->count == MAILBOX_SIZE ){
+		TracePrintf( 4, "[%d] mailbox is full\n", leader->id );
+		return ERROR;
+	}
+	mail = &leader->mailbox->messages[ (leader->mailbox->start + leader->mailbox->count) % MAILBOX_SIZE ];
+	mail->from = from;
+	memcpy( mail->message, message, IPC_MAX_LENGTH );
+	leader->mailbox->count += 1;
+	return 0;
+}
+
+/* take the oldest queued message from 'from', or from anybody if from is
+ * -1, and copy it to buffer. returns the sender or -1 if there is none.
+ */
+int takeMail( struct process * leader, int from, char * buffer ){
+	struct mailbox * mailbox = leader->mailbox;
+	int i;
+	if ( ! mailbox ){
+		return -1;
+	}
+	for ( i = 0; i < mailbox->count; i++ ){
+		struct mail * mail = &mailbox->messages[ (mailbox->start + i) % MAILBOX_SIZE ];
+		if ( from == -1 || mail->from == from ){
+			int sender = mail->from;
+			memcpy( buffer, mail->message, IPC_MAX_LENGTH );
+			/* close the gap, the mailbox is small */
+			for ( ; i > 0; i-- ){
+				mailbox->messages[ (mailbox->start + i) % MAILBOX_SIZE ] = mailbox->messages[ (mailbox->start + i - 1) % MAILBOX_SIZE ];
+			}
+			mailbox->start = (mailbox->start + 1) % MAILBOX_SIZE;
+			mailbox->count -= 1;
+			return sender;
+		}
+	}
+	return -1;
+}
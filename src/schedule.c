@@ -54,12 +54,15 @@ static struct process_list * nextProcess( struct process_list * list ){
 /* put the current process in old and the next process in new */
 void getNextProcess( struct process ** old, struct process ** new ){
 	
-	/* kill the os if there are no processes left */
+	/* kill the os if there are no processes left and the terminals have
+	 * sent everything they were given
+	 */
 	if ( run_list.next == &run_list &&
 	     io_list.next == 0 &&
 	     busy_list.next == 0 &&
 	     ipc_list.next == 0 &&
-	     delayed_list.next == 0 ){
+	     delayed_list.next == 0 &&
+	     ! terminalsTransmitting() ){
 		Halt();
 	}
 
@@ -116,6 +119,17 @@ void addToIoList( struct process_list * list ){
 	addToListTail( &io_list, list );
 }
 
+/* 1 if list is waiting for the disk */
+int onDiskList( struct process_list * list ){
+	struct process_list * waiting;
+	for ( waiting = disk_list.next; waiting != 0; waiting = waiting->next ){
+		if ( waiting == list ){
+			return 1;
+		}
+	}
+	return 0;
+}
+
 struct process_list * getDelayedList(){
 	return delayed_list.next;
 }
@@ -217,6 +231,36 @@ struct process_list * findIpc( int to, int from, int receive ){
 	return 0;
 }
 
+/* find a process blocked in Receive as 'receive' that takes a message
+ * from 'from'. processes waiting for a reply are skipped.
+ */
+struct process_list * findWaitingReceiver( int receive, int from ){
+	struct process_list * list;
+	for ( list = ipc_list.next; list != 0; list = list->next ){
+		struct ipc * obj = (struct ipc *) list->obj;
+		if ( obj->to == -1 && ! obj->reply && obj->receive == receive &&
+		     (obj->from == -1 || obj->from == from) ){
+			return list;
+		}
+	}
+	return 0;
+}
+
+/* find the sender that has waited longest for a worker on port. the ipc
+ * list is in newest first order so the last match is the oldest.
+ */
+struct process_list * findPortSender( int port ){
+	struct process_list * list;
+	struct process_list * oldest = 0;
+	for ( list = ipc_list.next; list != 0; list = list->next ){
+		struct ipc * obj = (struct ipc *) list->obj;
+		if ( obj->port == port ){
+			oldest = list;
+		}
+	}
+	return oldest;
+}
+
 void removeProcess( struct process * process ){
 
 	struct process_list * list = process->list;
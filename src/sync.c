@@ -0,0 +1,206 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sync.h"
+#include "debug.h"
+
+/* handle table, a handle is an index into it. slots of reclaimed
+ * objects are 0 and get reused.
+ */
+static struct sync_object ** objects = 0;
+static int max_objects = 0;
+
+/* no slot below this one is free */
+static int first_free = 0;
+
+/* processes in FutexWait hashed by the physical address of the futex.
+ * each bucket is a queue linked through process->next_waiter.
+ */
+#define FUTEX_BUCKETS 31
+
+static struct wait_queue futexes[ FUTEX_BUCKETS ];
+
+/* make a new object and return its handle or ERROR if there is no memory */
+int createSync( int type, int value ){
+	struct sync_object * object;
+	int handle;
+
+	for ( handle = first_free; handle < max_objects && objects[ handle ] != 0; handle++ ){
+	}
+
+	if ( handle == max_objects ){
+		int size = max_objects == 0 ? 16 : max_objects * 2;
+		struct sync_object ** more = (struct sync_object **) realloc( objects, sizeof( struct sync_object * ) * size );
+		if ( ! more ){
+			return ERROR;
+		}
+		bzero( more + max_objects, sizeof( struct sync_object * ) * (size - max_objects) );
+		objects = more;
+		max_objects = size;
+	}
+
+	object = (struct sync_object *) malloc( sizeof( struct sync_object ) );
+	if ( ! object ){
+		return ERROR;
+	}
+	object->type = type;
+	object->value = value;
+	object->holder = 0;
+	object->waiters.first = 0;
+	object->waiters.last = 0;
+
+	objects[ handle ] = object;
+	first_free = handle + 1;
+	return handle;
+}
+
+/* return the object for handle if it is of the given type, otherwise 0 */
+struct sync_object * findSync( int handle, int type ){
+	if ( handle < 0 || handle >= max_objects || objects[ handle ] == 0 ){
+		return 0;
+	}
+	if ( objects[ handle ]->type != type ){
+		return 0;
+	}
+	return objects[ handle ];
+}
+
+/* 1 if a process waiting on some cvar will take lock 'handle' back when
+ * it is woken up
+ */
+static int lockAwaited( int handle ){
+	int i;
+	for ( i = 0; i < max_objects; i++ ){
+		if ( objects[ i ] != 0 && objects[ i ]->type == SYNC_CVAR ){
+			struct process * waiter;
+			for ( waiter = objects[ i ]->waiters.first; waiter != 0; waiter = waiter->next_waiter ){
+				if ( waiter->cvar_lock == handle ){
+					return 1;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* destroy an object. fails if processes are blocked on it, it is a lock
+ * that is held or a lock that a cvar waiter has to take back. otherwise
+ * the handle could be reused while someone still refers to it.
+ */
+int reclaimSync( int handle ){
+	struct sync_object * object;
+	if ( handle < 0 || handle >= max_objects || objects[ handle ] == 0 ){
+		return ERROR;
+	}
+	object = objects[ handle ];
+	if ( object->waiters.first != 0 || object->holder != 0 ){
+		return ERROR;
+	}
+	if ( object->type == SYNC_LOCK && lockAwaited( handle ) ){
+		return ERROR;
+	}
+	free( object );
+	objects[ handle ] = 0;
+	if ( handle < first_free ){
+		first_free = handle;
+	}
+	return 0;
+}
+
+/* return some lock held by process or 0 if it holds none */
+struct sync_object * findHeldLock( struct process * process ){
+	int i;
+	for ( i = 0; i < max_objects; i++ ){
+		if ( objects[ i ] != 0 && objects[ i ]->type == SYNC_LOCK && objects[ i ]->holder == process ){
+			return objects[ i ];
+		}
+	}
+	return 0;
+}
+
+void enqueueWaiter( struct wait_queue * queue, struct process * process ){
+	process->next_waiter = 0;
+	if ( queue->last ){
+		queue->last->next_waiter = process;
+	} else {
+		queue->first = process;
+	}
+	queue->last = process;
+}
+
+/* take the oldest waiter off the queue, 0 if nobody is waiting */
+struct process * dequeueWaiter( struct wait_queue * queue ){
+	struct process * process = queue->first;
+	if ( process ){
+		queue->first = process->next_waiter;
+		if ( queue->first == 0 ){
+			queue->last = 0;
+		}
+		process->next_waiter = 0;
+	}
+	return process;
+}
+
+/* take process out of queue if it is in it */
+void removeWaiter( struct wait_queue * queue, struct process * process ){
+	struct process * previous = 0;
+	struct process * waiter;
+	for ( waiter = queue->first; waiter != 0; waiter = waiter->next_waiter ){
+		if ( waiter == process ){
+			if ( previous ){
+				previous->next_waiter = process->next_waiter;
+			} else {
+				queue->first = process->next_waiter;
+			}
+			if ( queue->last == process ){
+				queue->last = previous;
+			}
+			process->next_waiter = 0;
+			return;
+		}
+		previous = waiter;
+	}
+}
+
+/* take a process that is going away off every semaphore, lock, cvar and
+ * futex it waits on
+ */
+void forgetWaiter( struct process * process ){
+	int i;
+	for ( i = 0; i < max_objects; i++ ){
+		if ( objects[ i ] != 0 ){
+			removeWaiter( &objects[ i ]->waiters, process );
+		}
+	}
+	for ( i = 0; i < FUTEX_BUCKETS; i++ ){
+		removeWaiter( &futexes[ i ], process );
+	}
+}
+
+void futexEnqueue( unsigned long key, struct process * process ){
+	struct wait_queue * bucket = &futexes[ key % FUTEX_BUCKETS ];
+	process->futex_key = key;
+	enqueueWaiter( bucket, process );
+}
+
+/* take the oldest process waiting on key out of its bucket, 0 if there is none */
+struct process * futexDequeue( unsigned long key ){
+	struct wait_queue * bucket = &futexes[ key % FUTEX_BUCKETS ];
+	struct process * previous = 0;
+	struct process * process;
+	for ( process = bucket->first; process != 0; process = process->next_waiter ){
+		if ( process->futex_key == key ){
+			if ( previous ){
+				previous->next_waiter = process->next_waiter;
+			} else {
+				bucket->first = process->next_waiter;
+			}
+			if ( bucket->last == process ){
+				bucket->last = previous;
+			}
+			process->next_waiter = 0;
+			return process;
+		}
+		previous = process;
+	}
+	return 0;
+}
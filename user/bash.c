@@ -8,28 +8,79 @@
 #include <errno.h>
 #include "yalnix.h"
 #include "fs.h"
+#include "syscalls.h"
 
 #define MAX_LENGTH 1024  /* Should be long enough to hold any line */
 
 static void execProgram( int terminal, char ** argv, char * buf ){
 	int pid;
-	if ( pid = Fork() ){
-		int res;
-		if ( pid == -1 ){
-			TtyPrintf( terminal, "Shell: Cannot fork process\n" );
-			return;
+	int res;
+	if ( (pid = Spawn( argv[0], argv )) == ERROR ){
+		TtyPrintf( terminal, "Could not exec `%s'.\n", buf );
+		return;
+	}
+	if ( (pid = Wait(&res)) != -1 ){
+		// fprintf(stderr, "PID %d exit status = %d\n", pid, res);
+		// TtyPrintf( terminal, "PID %d exit status = %d\n", pid, res);
+	} else {
+		fprintf(stderr, "PID %d aborted by kernel.\n", pid);
+		TtyPrintf( terminal, "PID %d aborted by kernel.\n", pid);
+	}
+}
+
+/* run 'a | b | c'. the output of each program goes through a pipe to the
+ * input of the next one. words is the command line without the terminal
+ * and directory arguments, which are put back in for every program.
+ */
+static void execPipeline( int terminal, char ** words, char * b1, char * b2 ){
+	char * argv[ MAX_LENGTH ];
+	char * failed = 0;
+	int in = -1;
+	int started = 0;
+	int i = 0;
+	int res;
+
+	while ( words[ i ] != 0 ){
+		int out = -1;
+		int j = 0;
+		argv[ j++ ] = words[ i++ ];
+		argv[ j++ ] = b1;
+		argv[ j++ ] = b2;
+		while ( words[ i ] != 0 && strcmp( words[ i ], "|" ) != 0 ){
+			argv[ j++ ] = words[ i++ ];
+		}
+		argv[ j ] = 0;
+
+		if ( words[ i ] != 0 ){
+			/* skip the | */
+			i += 1;
+			if ( PipeCreate( &out ) == ERROR ){
+				failed = "pipe";
+				break;
+			}
 		}
-		if ( (pid = Wait(&res)) != -1 ){
-			// fprintf(stderr, "PID %d exit status = %d\n", pid, res);
-			// TtyPrintf( terminal, "PID %d exit status = %d\n", pid, res);
+
+		/* the child inherits the redirection. bash keeps the read end of
+		 * the new pipe until the next program is started so the pipe
+		 * does not go away if this one exits right away
+		 */
+		Redirect( in, out );
+		if ( Spawn( argv[ 0 ], argv ) == ERROR ){
+			failed = argv[ 0 ];
 		} else {
-			fprintf(stderr, "PID %d aborted by kernel.\n", pid);
-			TtyPrintf( terminal, "PID %d aborted by kernel.\n", pid);
+			started += 1;
 		}
-	} else {
-		Exec( argv[0], argv );
-		TtyPrintf( terminal, "Could not exec `%s'.\n", buf );
-		Exit( -2 );
+		Redirect( out, -1 );
+		in = out;
+	}
+
+	/* back to the terminal before printing anything */
+	Redirect( -1, -1 );
+	if ( failed ){
+		TtyPrintf( terminal, "Could not exec `%s'.\n", failed );
+	}
+	for ( i = 0; i < started; i++ ){
+		Wait( &res );
 	}
 }
 
@@ -194,13 +245,29 @@ int main( int argc, char *argv[] ){
 		sprintf( b1, "%d", termno );
 		char b2[ 16 ];
 		sprintf( b2, "%d", Lookup( current_path, 0 ) );
-		cmd_argv[j++] = b1;
-		cmd_argv[j++] = b2;
 
 		while ( cmd_argv[j++] = strtok(NULL, separators) ){
 			/**/
 		}
 
+		int pipeline = 0;
+		for ( i = 0; cmd_argv[ i ] != 0; i++ ){
+			if ( strcmp( cmd_argv[ i ], "|" ) == 0 ){
+				pipeline = 1;
+			}
+		}
+		if ( pipeline ){
+			execPipeline( termno, cmd_argv, b1, b2 );
+			continue;
+		}
+
+		/* insert the terminal and directory after the program name */
+		for ( i = j - 1; i >= 1; i-- ){
+			cmd_argv[ i + 2 ] = cmd_argv[ i ];
+		}
+		cmd_argv[ 1 ] = b1;
+		cmd_argv[ 2 ] = b2;
+
 		execProgram( termno, cmd_argv, buf );
 	}
 
@@ -3,16 +3,18 @@
 #include <stdio.h>
 
 void cat( int terminal, char * file, FH_t dir ){
-	char data[ 1024 ];
+	char data[ 4096 ];
 	int bytes = 0;
 	int offset = 0;
 	FH_t id = Lookup( file, dir );
 	if ( id != -1 ){
 		do{
-			bytes = Read( id, 1022, offset, data );
+			bytes = Read( id, sizeof( data ), offset, data );
 			if ( bytes > 0 ){
-				data[ bytes + 1 ] = 0;
-				TtyPrintf( terminal, "%s", data );
+				/* TtyWrite takes any length, no need to split it up */
+				if ( TtyWrite( terminal, data, bytes ) == ERROR ){
+					return;
+				}
 				offset += bytes;
 			}
 		} while ( bytes > 0 );
@@ -20,14 +22,29 @@ void cat( int terminal, char * file, FH_t dir ){
 	TtyPrintf( terminal, "\n" );
 }
 
+/* copy the input to the output, which is how cat works at the end of a pipe */
+void copyInput( int terminal ){
+	char data[ 1024 ];
+	int bytes;
+	while ( (bytes = TtyRead( terminal, data, sizeof( data ) )) > 0 ){
+		if ( TtyWrite( terminal, data, bytes ) == ERROR ){
+			return;
+		}
+	}
+}
+
 int main( int argc, char ** argv ){
-	if ( argc < 4 ){
+	if ( argc < 3 ){
 		return 0;
 	}
 
 	int terminal = atoi( argv[ 1 ] );
 	FH_t dir = atoi( argv[ 2 ] );
 	int i;
+	if ( argc == 3 ){
+		copyInput( terminal );
+		return 0;
+	}
 	for ( i = 3; i < argc; i++ ){
 		cat( terminal, argv[ i ], dir );
 	}
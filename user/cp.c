@@ -43,14 +43,49 @@ int main( int argc, char ** argv ){
 	char data[ 4096 ];
 	int offset = 0;
 	int bytes = 0;
+
+	/* on a shared memory ring the write of a chunk goes to the server
+	 * together with the read of the next one
+	 */
+	struct fs_ring * ring = FsRingOpen();
+	if ( ring ){
+		int status = 0;
+		FsRingSubmit( ring, READ, src_id, FS_RING_DATA, offset, 0 );
+		while ( (bytes = FsRingWait( ring, data )) > 0 ){
+			TtyPrintf( terminal, "Copy %d bytes from %d to %d\n", bytes, src_id, dest_id );
+			FsRingSubmit( ring, WRITE, dest_id, bytes, offset, data );
+			offset += bytes;
+			FsRingSubmit( ring, READ, src_id, FS_RING_DATA, offset, 0 );
+			if ( FsRingWait( ring, 0 ) != bytes ){
+				status = -1;
+				break;
+			}
+		}
+		if ( bytes < 0 ){
+			status = -1;
+		}
+		FsRingClose( ring );
+		if ( status != 0 ){
+			TtyPrintf( terminal, "Could not copy %s to %s\n", src, dest );
+		}
+		return status;
+	}
+
 	do{
 		bytes = Read( src_id, 4096, offset, data );
 		if ( bytes > 0 ){
 			TtyPrintf( terminal, "Copy %d bytes from %d to %d\n", bytes, src_id, dest_id );
-			Write( dest_id, bytes, offset, data );
+			if ( Write( dest_id, bytes, offset, data ) != bytes ){
+				bytes = ERROR;
+				break;
+			}
 			offset += bytes;
 		}
 	} while ( bytes > 0 );
 
+	if ( bytes < 0 ){
+		TtyPrintf( terminal, "Could not copy %s to %s\n", src, dest );
+		return -1;
+	}
 	return 0;
 }
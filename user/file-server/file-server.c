@@ -1,5 +1,6 @@
 #include "fs.h"
 #include "yalnix.h"
+#include "syscalls.h"
 #include "filesystem.h"
 #include "hardware.h"
 #include <stdlib.h>
@@ -29,6 +30,27 @@ struct sector_cache{
 #define MAX_CACHED_SECTORS 32
 static struct sector_cache cached[ MAX_CACHED_SECTORS ];
 
+/* clock ticks without a request before dirty sectors are written back */
+#define FLUSH_TICKS 5
+
+/* clients using a shared memory channel instead of messages */
+#define MAX_RINGS 4
+
+struct ring_client{
+	/* pid of the client, 0 for an unused entry */
+	int id;
+	struct fs_ring * ring;
+	/* requests served. the client can write the copy in the ring, so
+	 * this one is what counts
+	 */
+	int completed;
+};
+
+static struct ring_client rings[ MAX_RINGS ];
+
+/* pages MapShared needs for one ring */
+#define RING_PAGES ((sizeof( struct fs_ring ) + PAGESIZE - 1) / PAGESIZE)
+
 /* keeps track of which blocks are being used */
 struct file_block{
 	/* 1 or 0 */
@@ -135,6 +157,28 @@ static void writeCachedSector( int sector, char * data ){
 	cache->usage += 1;
 }
 
+/* 1 if some cached sector has not been written to disk */
+static int cacheIsDirty(){
+	int i;
+	for ( i = 0; i < MAX_CACHED_SECTORS; i++ ){
+		if ( cached[ i ].dirty ){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* write every dirty cached sector to disk */
+static void flushCache(){
+	int i;
+	for ( i = 0; i < MAX_CACHED_SECTORS; i++ ){
+		if ( cached[ i ].dirty ){
+			WriteSector( cached[ i ].block, cached[ i ].data );
+			cached[ i ].dirty = 0;
+		}
+	}
+}
+
 /* return the entry in the directory that has the right name */
 struct directory_entry * findEntry( struct directory * root, char * name ){
 	int i;
@@ -574,12 +618,7 @@ static void syncDisk(){
 	}
 	// TtyPrintf( 0, "[fs] Wrote %d sectors\n", sector );
 
-	for ( i = 0; i < MAX_CACHED_SECTORS; i++ ){
-		if ( cached[ i ].dirty ){
-			WriteSector( cached[ i ].block, cached[ i ].data );
-			cached[ i ].dirty = 0;
-		}
-	}
+	flushCache();
 }
 
 /* copy a string from some other process */
@@ -949,6 +988,43 @@ static int maxInodeSize( struct inode * node ){
 	return total;
 }
 
+/* the block of node that holds byte *offset. *offset becomes the offset
+ * inside that block. returns -1 if the file has no such block.
+ */
+static int seekBlock( struct inode * node, int * offset ){
+	int block = node->block;
+	while ( block != -1 && *offset >= SECTORSIZE ){
+		*offset -= SECTORSIZE;
+		block = blocks[ block ].next;
+	}
+	return block;
+}
+
+/* add blocks to node until it can hold size bytes. returns 0 or ERROR */
+static int growInode( struct inode * node, int size ){
+	if ( node->block == -1 ){
+		node->block = findFreeBlock();
+		if ( node->block == -1 ){
+			return ERROR;
+		}
+	}
+
+	int block = node->block;
+	while ( blocks[ block ].next != -1 ){
+		block = blocks[ block ].next;
+	}
+
+	while ( size > maxInodeSize( node ) ){
+		int next_block = findFreeBlock();
+		if ( next_block == -1 ){
+			return ERROR;
+		}
+		blocks[ block ].next = next_block;
+		block = next_block;
+	}
+	return 0;
+}
+
 /* read some bytes from an inode */
 static void handleRead( int id, struct fs_message_read * message ){
 	struct inode * node = findInode( message->file );
@@ -964,38 +1040,39 @@ static void handleRead( int id, struct fs_message_read * message ){
 	
 	TtyPrintf( 0, "[fs] Reading %d bytes from file %d at offset %d\n", bytes, node->id, offset );
 
-	int block = node->block;
+	bytes = offset + bytes > node->size ? node->size - offset : bytes;
+
+	int block = seekBlock( node, &offset );
 	if ( block == -1 ){
 		message->code = ERROR;
 		return;
 	}
-	
-	bytes = offset + bytes > node->size ? node->size - offset : bytes;
 
-	while ( offset >= SECTORSIZE ){
-		offset -= SECTORSIZE;
-		block = blocks[ block ].next;
-		if ( block == -1 ){
-			message->code = ERROR;
-			return;
-		}
-	}
-
-	char data[ SECTORSIZE ];
+	/* the sectors go to the client in batches of one CopyToV each */
+	char data[ COPY_MAX_SEGMENTS ][ SECTORSIZE ];
+	struct copy_segment segments[ COPY_MAX_SEGMENTS ];
+	int count = 0;
 	// ReadSector( block, data );
-	readCachedSector( block, data );
+	readCachedSector( block, data[ 0 ] );
 	int max_length = SECTORSIZE - offset;
 	int bytes_read = 0;
 	while ( bytes > 0 ){
 		int min = max_length < bytes ? max_length : bytes;
 		TtyPrintf( 0, "[fs] Reading %d bytes at offset %d from block %d\n", min, offset, block );
-		CopyTo( id, user_buffer, data + offset, min );
-		max_length -= min;
+		segments[ count ] = (struct copy_segment){ .local = data[ count ] + offset, .remote = user_buffer + bytes_read, .length = min };
+		count += 1;
 		bytes -= min;
 		bytes_read += min;
-		if ( max_length == 0 && bytes > 0 ){
+		if ( count == COPY_MAX_SEGMENTS || bytes == 0 ){
+			if ( CopyToV( id, segments, count ) == ERROR ){
+				message->code = ERROR;
+				return;
+			}
+			count = 0;
+		}
+		if ( bytes > 0 ){
 			block = blocks[ block ].next;
-			readCachedSector( block, data );
+			readCachedSector( block, data[ count ] );
 			max_length = SECTORSIZE;
 			offset = 0;
 		}
@@ -1020,57 +1097,50 @@ static void handleWrite( int id, struct fs_message_write * message ){
 
 	TtyPrintf( 0, "[fs] Writing %d bytes into file %d at offset %d\n", bytes, node->id, offset );
 
-	if ( node->block == -1 ){
-		node->block = findFreeBlock();
-		if ( node->block == -1 ){
-			message->code = ERROR;
-			return;
-		}
-	}
-
-	int block = node->block;
-	while ( blocks[ block ].next != -1 ){
-		block = blocks[ block ].next;
-	}
-
 	/* make sure file is big enough */
-	while ( offset + bytes > maxInodeSize( node ) ){
-		int next_block = findFreeBlock();
-		if ( next_block == -1 ){
-			message->code = ERROR;
-			return;
-		}
-		blocks[ block ].next = next_block;
-		block = next_block;
+	if ( growInode( node, offset + bytes ) == ERROR ){
+		message->code = ERROR;
+		return;
 	}
 
 	/* seek to the write block */
-	block = node->block;
-	while ( offset >= SECTORSIZE ){
-		block = blocks[ block ].next;
-		offset -= SECTORSIZE;
-	}
+	int block = seekBlock( node, &offset );
 
 	node->timestamp = timeNow();
 
 	TtyPrintf( 0, "[fs] Start to write at offset %d in block %d\n", offset, block );
 
-	char data[ SECTORSIZE ];
-	// ReadSector( block, data );
-	readCachedSector( block, data );
+	/* the client's bytes come over in batches of one CopyFromV each */
+	char data[ COPY_MAX_SEGMENTS ][ SECTORSIZE ];
+	struct copy_segment segments[ COPY_MAX_SEGMENTS ];
+	int sectors[ COPY_MAX_SEGMENTS ];
+	int count = 0;
+	int written = 0;
 	int max_length = SECTORSIZE - offset;
 	while ( bytes > 0 ){
 		int min = max_length < bytes ? max_length : bytes;
 		TtyPrintf( 0, "[fs] Writing %d bytes at offset %d into block %d\n", min, offset, block );
-		CopyFrom( id, data + offset, user_buffer, min );
-		// WriteSector( block, data );
-		writeCachedSector( block, data );
-		max_length -= min;
+		// ReadSector( block, data );
+		readCachedSector( block, data[ count ] );
+		sectors[ count ] = block;
+		segments[ count ] = (struct copy_segment){ .local = data[ count ] + offset, .remote = user_buffer + written, .length = min };
+		count += 1;
 		bytes -= min;
-		if ( max_length == 0 && bytes > 0 ){
+		written += min;
+		if ( count == COPY_MAX_SEGMENTS || bytes == 0 ){
+			int i;
+			if ( CopyFromV( id, segments, count ) == ERROR ){
+				message->code = ERROR;
+				return;
+			}
+			for ( i = 0; i < count; i++ ){
+				// WriteSector( block, data );
+				writeCachedSector( sectors[ i ], data[ i ] );
+			}
+			count = 0;
+		}
+		if ( bytes > 0 ){
 			block = blocks[ block ].next;
-			// ReadSector( block, data );
-			readCachedSector( block, data );
 			max_length = SECTORSIZE;
 			offset = 0;
 		}
@@ -1146,6 +1216,204 @@ static void handleSync( int id, struct fs_message_sync * message ){
 	}
 }
 
+/* read from an inode into the data of a ring request */
+static int ringRead( struct fs_ring_request * request ){
+	struct inode * node = findInode( request->file );
+	int offset = request->offset;
+	int bytes = request->count;
+	int done = 0;
+
+	if ( node == 0 || node->type == INODE_DIRECTORY || offset < 0 || bytes < 0 || bytes > FS_RING_DATA ){
+		return ERROR;
+	}
+
+	bytes = offset + bytes > node->size ? node->size - offset : bytes;
+	int block = seekBlock( node, &offset );
+	if ( block == -1 ){
+		return ERROR;
+	}
+
+	while ( done < bytes && block != -1 ){
+		char data[ SECTORSIZE ];
+		int min = SECTORSIZE - offset < bytes - done ? SECTORSIZE - offset : bytes - done;
+		readCachedSector( block, data );
+		memcpy( request->data + done, data + offset, min );
+		done += min;
+		offset = 0;
+		block = blocks[ block ].next;
+	}
+
+	return done;
+}
+
+/* write the data of a ring request into an inode */
+static int ringWrite( struct fs_ring_request * request ){
+	struct inode * node = findInode( request->file );
+	int offset = request->offset;
+	int bytes = request->count;
+	int done = 0;
+
+	if ( node == 0 || node->type == INODE_DIRECTORY || offset < 0 || bytes < 0 || bytes > FS_RING_DATA ){
+		return ERROR;
+	}
+	if ( growInode( node, offset + bytes ) == ERROR ){
+		return ERROR;
+	}
+
+	int block = seekBlock( node, &offset );
+	node->timestamp = timeNow();
+	while ( done < bytes ){
+		char data[ SECTORSIZE ];
+		int min = SECTORSIZE - offset < bytes - done ? SECTORSIZE - offset : bytes - done;
+		readCachedSector( block, data );
+		memcpy( data + offset, request->data + done, min );
+		writeCachedSector( block, data );
+		done += min;
+		offset = 0;
+		block = blocks[ block ].next;
+	}
+
+	if ( node->size < request->offset + bytes ){
+		node->size = request->offset + bytes;
+	}
+	return bytes;
+}
+
+/* do one request from a ring and return its code */
+static int serveRingRequest( struct fs_ring_request * request ){
+	switch ( request->type ){
+		case READ : {
+			return ringRead( request );
+		}
+		case WRITE : {
+			return ringWrite( request );
+		}
+		case STAT : {
+			struct fs_message_stat message = { .type = STAT, .file = request->file, .code = 0 };
+			handleStat( 0, &message );
+			return message.code;
+		}
+		case STAMP : {
+			struct fs_message_stamp message = { .type = STAMP, .file = request->file, .code = 0 };
+			handleStamp( 0, &message );
+			return message.code;
+		}
+		case SYNC : {
+			struct fs_message_sync message = { .type = SYNC, .file = request->file, .code = 0 };
+			handleSync( 0, &message );
+			return message.code;
+		}
+		default : {
+			return ERROR;
+		}
+	}
+}
+
+static void closeRing( struct ring_client * client );
+
+/* do everything that was submitted on the rings and wake up the clients
+ * that got results. a client that claims more than FS_RING_SLOTS requests
+ * are outstanding broke the protocol and loses its ring.
+ */
+static void serveRings(){
+	int i;
+	for ( i = 0; i < MAX_RINGS; i++ ){
+		struct ring_client * client = &rings[ i ];
+		struct fs_ring * ring = client->ring;
+		int submitted;
+		int done = 0;
+		if ( client->id == 0 ){
+			continue;
+		}
+		submitted = ring->submitted;
+		if ( submitted - client->completed < 0 || submitted - client->completed > FS_RING_SLOTS ){
+			TtyPrintf( 0, "[fs] Bad ring from %d, closing it\n", client->id );
+			closeRing( client );
+			continue;
+		}
+		while ( client->completed != submitted ){
+			struct fs_ring_request * request = &ring->slots[ client->completed % FS_RING_SLOTS ];
+			request->code = serveRingRequest( request );
+			client->completed += 1;
+			done += 1;
+		}
+		if ( done > 0 ){
+			ring->completed = client->completed;
+			FutexWake( &ring->completed, 1 );
+		}
+	}
+}
+
+static int openRings(){
+	int i;
+	int count = 0;
+	for ( i = 0; i < MAX_RINGS; i++ ){
+		if ( rings[ i ].id != 0 ){
+			count += 1;
+		}
+	}
+	return count;
+}
+
+static void closeRing( struct ring_client * client ){
+	UnmapShared( client->ring, RING_PAGES );
+	client->id = 0;
+	client->ring = 0;
+	client->completed = 0;
+}
+
+/* 1 if process id still exists. IpcStats only reads counters, so the
+ * client is not disturbed the way a Doorbell would
+ */
+static int clientAlive( int id ){
+	struct ipc_stats stats;
+	return IpcStats( IPC_STATS_PROCESS, id, &stats ) != ERROR;
+}
+
+/* share a ring with a client. rings of clients that exited without closing
+ * them are taken back when all are in use.
+ */
+static void handleRingOpen( int id, struct fs_message_ring * message ){
+	int i;
+	for ( i = 0; i < MAX_RINGS && rings[ i ].id != 0; i++ ){
+	}
+	if ( i == MAX_RINGS ){
+		for ( i = 0; i < MAX_RINGS && clientAlive( rings[ i ].id ); i++ ){
+		}
+		if ( i == MAX_RINGS ){
+			message->code = ERROR;
+			return;
+		}
+		closeRing( &rings[ i ] );
+	}
+
+	int address = MapShared( id, RING_PAGES );
+	if ( address == ERROR ){
+		message->code = ERROR;
+		return;
+	}
+
+	TtyPrintf( 0, "[fs] Ring for %d at %p\n", id, (void *) address );
+	rings[ i ].id = id;
+	rings[ i ].ring = (struct fs_ring *) address;
+	rings[ i ].completed = 0;
+	message->ring = rings[ i ].ring;
+	message->server = GetPid();
+	message->code = 0;
+}
+
+static void handleRingClose( int id, struct fs_message_ring * message ){
+	int i;
+	for ( i = 0; i < MAX_RINGS; i++ ){
+		if ( rings[ i ].id == id && rings[ i ].ring == message->ring ){
+			closeRing( &rings[ i ] );
+			message->code = 0;
+			return;
+		}
+	}
+	message->code = ERROR;
+}
+
 /* polymorphic function converter.
  * converts unknown data type to some concrete type
  */
@@ -1220,6 +1488,35 @@ void handle( int id, void * data ){
 			handleReadDir( id, (struct fs_message_readdir *) data );
 			break;
 		}
+		case RING_OPEN : {
+			handleRingOpen( id, (struct fs_message_ring *) data );
+			break;
+		}
+		case RING_CLOSE : {
+			handleRingClose( id, (struct fs_message_ring *) data );
+			break;
+		}
+	}
+}
+
+/* serve the rings until a message comes in and return its sender. dirty
+ * sectors are written back once nothing happened for FLUSH_TICKS ticks.
+ */
+static int waitForMessage( char * message ){
+	while ( 1 ){
+		int ready;
+		serveRings();
+		ready = Select( 0, SELECT_MESSAGE | SELECT_DOORBELL, cacheIsDirty() ? FLUSH_TICKS : -1 );
+		if ( ready == ERROR ){
+			return ERROR;
+		}
+		if ( ready == 0 ){
+			TtyPrintf( 0, "[fs] Idle, flushing the cache\n" );
+			flushCache();
+		}
+		if ( ready & SELECT_MESSAGE ){
+			return Receive( message );
+		}
 	}
 }
 
@@ -1423,10 +1720,27 @@ int main(){
 	initializeSuperBlock( &super_block );
 
 	char message[ 32 ];
-	int from;
-	while ( alive && (from = Receive( message )) != ERROR ){
+	int from = Receive( message );
+	while ( from != ERROR ){
 		handle( from, message );
+		if ( ! alive ){
+			Reply( message, from );
+			break;
+		}
+		if ( ! cacheIsDirty() && openRings() == 0 ){
+			from = ReplyAndReceive( message, from );
+			/* the client went away before its reply, serve the next one */
+			if ( from == ERROR ){
+				from = Receive( message );
+			}
+			continue;
+		}
+
+		/* write the dirty sectors back once the clients go quiet and
+		 * keep the rings going
+		 */
 		Reply( message, from );
+		from = waitForMessage( message );
 	}
 	
 	TtyPrintf( 0, "[fs] Shutdown success\n" );
@@ -0,0 +1,51 @@
+/* children join a notification group and the parent reaches all of them
+ * with one GroupNotify, first with some news and then to shut them down
+ */
+
+#include <string.h>
+#include "yalnix.h"
+#include "syscalls.h"
+
+#define CHILDREN 3
+
+int main(){
+	int parent = GetPid();
+	int group;
+	int i;
+
+	if ( GroupCreate( &group ) == ERROR ){
+		TtyPrintf( 0, "Could not create a group\n" );
+		return 1;
+	}
+
+	for ( i = 0; i < CHILDREN; i++ ){
+		if ( Fork() == 0 ){
+			char message[ 32 ] = "ready";
+			GroupJoin( group );
+			SendAsync( message, parent );
+			do{
+				int from = Receive( message );
+				TtyPrintf( 0, "%d got '%s' from %d\n", GetPid(), message, from );
+			} while ( strcmp( message, "shutdown" ) != 0 );
+			Exit( 0 );
+		}
+	}
+
+	/* everybody has to be in the group before the first notification */
+	for ( i = 0; i < CHILDREN; i++ ){
+		char message[ 32 ];
+		Receive( message );
+	}
+
+	char news[ 32 ] = "directory changed";
+	TtyPrintf( 0, "News reached %d children\n", GroupNotify( news, group ) );
+	char shutdown[ 32 ] = "shutdown";
+	TtyPrintf( 0, "Shutdown reached %d children\n", GroupNotify( shutdown, group ) );
+
+	for ( i = 0; i < CHILDREN; i++ ){
+		int status;
+		Wait( &status );
+	}
+	GroupLeave( group );
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include "yalnix.h"
+#include "syscalls.h"
 #ifdef LINUX
 #define NULL 0
 #endif
@@ -10,19 +11,15 @@
 
 #define MAX_ARGC 32
 
-#define NOFORK (-1)
-#define NOEXEC (-2)
+#define NOEXEC (-1)
 
-int ForkChild(char * cmd_argv[])
+int SpawnChild(char * cmd_argv[])
 {
   int pid;
 
-  switch (pid = Fork()) {
-  case 0:
-    Exec(cmd_argv[0], cmd_argv);
-    return NOEXEC;
+  switch (pid = Spawn(cmd_argv[0], cmd_argv)) {
   case ERROR:
-    return NOFORK;
+    return NOEXEC;
   default:
     return pid;
     break;
@@ -40,13 +37,11 @@ char * getProgram( int id ){
 
 void startFileServer(){
 	TtyPrintf( 0, "Starting file server\n" );
-	if ( Fork() == 0 ){
-		char * argv[ 2 ];
-		argv[ 0 ] = "fileserver";
-		argv[ 1 ] = 0;
-		Exec( "fileserver", argv );
+	char * argv[ 2 ];
+	argv[ 0 ] = "fileserver";
+	argv[ 1 ] = 0;
+	if ( Spawn( "fileserver", argv ) == ERROR ){
 		TtyPrintf( 0, "Could not start file server\n" );
-		// Exit( -1 );
 	}
 }
 
@@ -76,19 +71,13 @@ int main(int argc, char *argv[]){
     }      
     */
 
-    switch (pids[i] = ForkChild(cmd_argv)) {
+    switch (pids[i] = SpawnChild(cmd_argv)) {
     case NOEXEC:
       TtyPrintf(CONSOLE," forking to terminal %d, %s %s\n", i, 
 		cmd_argv[0], cmd_argv[1]);
       TtyPrintf(CONSOLE,
 	"Control prog for terminal %d could not be started.\n", i);
       break;
-    case NOFORK:
-      TtyPrintf(CONSOLE," forking to terminal %d, %s %s\n", i, 
-		cmd_argv[0], cmd_argv[1]);
-      TtyPrintf(CONSOLE,
-		"Error in Fork() for terminal %d.\n", i);  
-      break;
     default:
       TtyPrintf(CONSOLE," forking to terminal %d, %s %s\n", i, 
 		cmd_argv[0], cmd_argv[1]);
@@ -129,18 +118,13 @@ int main(int argc, char *argv[]){
     // cmd_argv[0] = "bash";
     cmd_argv[ 0 ] = getProgram( i );
     sprintf(numbuf, "%d", i);
-    pids[i] = ForkChild(cmd_argv);
+    pids[i] = SpawnChild(cmd_argv);
     switch (pids[i]) {
     case NOEXEC:
       TtyPrintf(CONSOLE,
 		"Shell for terminal %d could not be started.\n", i);
       child_cnt--;
       break;
-    case NOFORK:
-      TtyPrintf(CONSOLE,
-		"Error in Fork() for terminal shell %d.\n", i);  
-      child_cnt--;
-      break;
     default:
       TtyPrintf(CONSOLE,
 		"Started shell with pid %d in terminal %d.\n",
@@ -0,0 +1,53 @@
+/* $ ipcstat port 1
+ * $ ipcstat pid 5
+ * Prints the ipc counters of a port or a process: how many Sends it saw,
+ * how long they waited for a receiver and for the reply on average and as
+ * a histogram, and how many bytes were copied. Run it on the ports of the
+ * servers to see which one makes its clients wait.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "yalnix.h"
+#include "syscalls.h"
+
+static void showHistogram( const char * name, unsigned int * histogram ){
+	int i;
+	TtyPrintf( 0, "%s\n", name );
+	for ( i = 0; i < IPC_HISTOGRAM_BUCKETS; i++ ){
+		if ( histogram[ i ] == 0 ){
+			continue;
+		}
+		/* the last bucket has every wait that is longer */
+		if ( i == IPC_HISTOGRAM_BUCKETS - 1 ){
+			TtyPrintf( 0, "  >= %u us: %u\n", 1U << (i - 1), histogram[ i ] );
+		} else {
+			TtyPrintf( 0, "  < %u us: %u\n", 1U << i, histogram[ i ] );
+		}
+	}
+}
+
+int main( int argc, char ** argv ){
+	struct ipc_stats stats;
+	int who;
+
+	if ( argc < 3 || (strcmp( argv[ 1 ], "port" ) != 0 && strcmp( argv[ 1 ], "pid" ) != 0) ){
+		TtyPrintf( 0, "Usage: %s port|pid id\n", argv[ 0 ] );
+		return 1;
+	}
+
+	who = strcmp( argv[ 1 ], "port" ) == 0 ? IPC_STATS_PORT : IPC_STATS_PROCESS;
+	if ( IpcStats( who, atoi( argv[ 2 ] ), &stats ) == ERROR ){
+		TtyPrintf( 0, "No ipc statistics for %s %s\n", argv[ 1 ], argv[ 2 ] );
+		return 1;
+	}
+
+	TtyPrintf( 0, "sends %u receives %u replies %u bytes copied %llu\n", stats.sends, stats.receives, stats.replies, stats.bytes_copied );
+	if ( stats.sends > 0 ){
+		TtyPrintf( 0, "waiting for a receiver %llu us, %llu us per send\n", stats.receiver_wait, stats.receiver_wait / stats.sends );
+		TtyPrintf( 0, "waiting for the reply %llu us, %llu us per send\n", stats.reply_wait, stats.reply_wait / stats.sends );
+		showHistogram( "receiver wait", stats.receiver_histogram );
+		showHistogram( "reply wait", stats.reply_histogram );
+	}
+	return 0;
+}
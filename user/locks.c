@@ -0,0 +1,134 @@
+/* a bounded buffer shared by producer and consumer threads using a lock
+ * and two condition variables, threads counting under a user space lock,
+ * then a semaphore ping pong with a child
+ */
+
+#include "yalnix.h"
+#include "syscalls.h"
+#include "ulock.h"
+
+#define SLOTS 2
+#define ITEMS 6
+
+static int buffer[ SLOTS ];
+static int count = 0;
+static int lock;
+static int not_full;
+static int not_empty;
+
+static void producer( int n ){
+	int i;
+	for ( i = 0; i < ITEMS; i++ ){
+		Acquire( lock );
+		while ( count == SLOTS ){
+			CvarWait( not_full, lock );
+		}
+		buffer[ count ] = i;
+		count += 1;
+		CvarSignal( not_empty );
+		Release( lock );
+	}
+	ThreadExit( 0 );
+}
+
+static void consumer( int n ){
+	int i;
+	for ( i = 0; i < ITEMS; i++ ){
+		int item;
+		Acquire( lock );
+		while ( count == 0 ){
+			CvarWait( not_empty, lock );
+		}
+		count -= 1;
+		item = buffer[ count ];
+		CvarSignal( not_full );
+		Release( lock );
+		TtyPrintf( 0, "Consumed %d\n", item );
+	}
+	ThreadExit( 0 );
+}
+
+static volatile int fast_lock = ULOCK_INITIALIZER;
+static int total = 0;
+
+static void adder( int n ){
+	int i;
+	for ( i = 0; i < 100; i++ ){
+		ulockAcquire( &fast_lock );
+		total += 1;
+		/* sleep with the lock held now and then so the others have to wait in the kernel */
+		if ( i % 25 == 0 ){
+			Delay( 1 );
+		}
+		ulockRelease( &fast_lock );
+	}
+	ThreadExit( 0 );
+}
+
+static void countTogether(){
+	int tids[ 3 ];
+	int i;
+	for ( i = 0; i < 3; i++ ){
+		tids[ i ] = ThreadCreate( adder, i );
+	}
+	for ( i = 0; i < 3; i++ ){
+		if ( tids[ i ] != ERROR ){
+			ThreadJoin( tids[ i ], 0 );
+		}
+	}
+	TtyPrintf( 0, "Total is %d\n", total );
+}
+
+static void pingPong(){
+	int ping, pong;
+	int i;
+	if ( SemInit( &ping, 0 ) == ERROR || SemInit( &pong, 0 ) == ERROR ){
+		TtyPrintf( 0, "Could not create semaphores\n" );
+		return;
+	}
+
+	/* the handles are inherited by the child */
+	if ( Fork() == 0 ){
+		for ( i = 0; i < 3; i++ ){
+			SemDown( ping );
+			TtyPrintf( 0, "pong %d\n", i );
+			SemUp( pong );
+		}
+		Exit( 0 );
+	}
+
+	for ( i = 0; i < 3; i++ ){
+		TtyPrintf( 0, "ping %d\n", i );
+		SemUp( ping );
+		SemDown( pong );
+	}
+	Wait( &i );
+	Reclaim( ping );
+	Reclaim( pong );
+}
+
+int main(){
+	int producer_id, consumer_id;
+
+	if ( LockInit( &lock ) == ERROR || CvarInit( &not_full ) == ERROR || CvarInit( &not_empty ) == ERROR ){
+		TtyPrintf( 0, "Could not create lock and cvars\n" );
+		return 1;
+	}
+
+	consumer_id = ThreadCreate( consumer, 0 );
+	producer_id = ThreadCreate( producer, 0 );
+	if ( consumer_id == ERROR || producer_id == ERROR ){
+		TtyPrintf( 0, "Could not create threads\n" );
+		return 1;
+	}
+	ThreadJoin( producer_id, 0 );
+	ThreadJoin( consumer_id, 0 );
+
+	if ( Reclaim( lock ) == ERROR || Reclaim( not_full ) == ERROR || Reclaim( not_empty ) == ERROR ){
+		TtyPrintf( 0, "Could not reclaim lock and cvars\n" );
+	}
+
+	countTogether();
+	pingPong();
+	return 0;
+}
@@ -0,0 +1,43 @@
+/* children post notifications to the parent with SendAsync. they never
+ * block, and the parent drains its mailbox with Receive
+ */
+
+#include <stdio.h>
+#include "yalnix.h"
+#include "syscalls.h"
+
+#define CHILDREN 3
+#define NOTES 4
+
+int main(){
+	int parent = GetPid();
+	int i;
+	for ( i = 0; i < CHILDREN; i++ ){
+		if ( Fork() == 0 ){
+			int n;
+			for ( n = 0; n < NOTES; n++ ){
+				char message[ 32 ];
+				sprintf( message, "note %d", n );
+				if ( SendAsync( message, parent ) == ERROR ){
+					TtyPrintf( 0, "%d: mailbox of %d is full\n", GetPid(), parent );
+				}
+			}
+			Exit( 0 );
+		}
+	}
+
+	for ( i = 0; i < CHILDREN * NOTES; i++ ){
+		char message[ 32 ];
+		int pid = Receive( message );
+		if ( pid == ERROR ){
+			break;
+		}
+		TtyPrintf( 0, "Got '%s' from %d\n", message, pid );
+	}
+
+	for ( i = 0; i < CHILDREN; i++ ){
+		int status;
+		Wait( &status );
+	}
+	return 0;
+}
@@ -1,4 +1,5 @@
 #include "yalnix.h"
+#include "syscalls.h"
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -17,20 +18,29 @@ int main( int argc, char ** argv ){
 
 	int myid = GetPid();
 	int quit = 0;
-	while ( ! quit ){
-		char buffer[ 32 ];
-		int pid = Receive( buffer );
-		if ( pid != ERROR ){
-			buffer[ 31 ] = 0;
-			TtyPrintf( 0, "Server received '%s' from %d\n", buffer, pid );
-			quit = strcasecmp( buffer, "quit" ) == 0;
-			snprintf( buffer, 32, "ping from server %d", myid );
+	char buffer[ 32 ];
+	int pid = Receive( buffer );
+	while ( pid != ERROR ){
+		buffer[ 31 ] = 0;
+		TtyPrintf( 0, "Server received '%s' from %d\n", buffer, pid );
+		quit = strcasecmp( buffer, "quit" ) == 0;
+		snprintf( buffer, 32, "ping from server %d", myid );
+		if ( quit ){
 			if ( Reply( buffer, pid ) == ERROR ){
 				TtyPrintf( 0, "Server couldn't send reply to %d\n", pid );
 			}
-		} else {
-			TtyPrintf( 0, "Server couldn't receive message\n" );
+			break;
 		}
+		/* answer this client and wait for the next one in one call */
+		int client = pid;
+		pid = ReplyAndReceive( buffer, client );
+		if ( pid == ERROR ){
+			TtyPrintf( 0, "Server couldn't send reply to %d\n", client );
+			pid = Receive( buffer );
+		}
+	}
+	if ( pid == ERROR ){
+		TtyPrintf( 0, "Server couldn't receive message\n" );
 	}
 
 	TtyPrintf( 0, "Server releasing port %d\n", port );
@@ -0,0 +1,57 @@
+/* one process waits for terminal input, messages from a child and the
+ * child's exit at the same time with Select, and notices when nothing
+ * happens for a while
+ */
+
+#include "yalnix.h"
+#include "syscalls.h"
+
+#define QUIET_TICKS 10
+
+int main(){
+	int parent = GetPid();
+	int child;
+	int alive = 1;
+
+	child = Fork();
+	if ( child == 0 ){
+		char message[ 32 ] = "hello";
+		Delay( 3 );
+		Send( message, parent );
+		Delay( 3 );
+		Exit( 7 );
+	}
+
+	TtyPrintf( 0, "Type something while the child runs\n" );
+	while ( alive ){
+		int ready = Select( SELECT_TTY( 0 ), SELECT_MESSAGE | SELECT_CHILD, QUIET_TICKS );
+		if ( ready == ERROR ){
+			TtyPrintf( 0, "Select failed\n" );
+			return 1;
+		}
+		if ( ready == 0 ){
+			TtyPrintf( 0, "Nothing happened for %d ticks\n", QUIET_TICKS );
+		}
+		if ( ready & SELECT_TTY( 0 ) ){
+			char line[ 64 ];
+			int length = TtyRead( 0, line, sizeof( line ) - 1 );
+			if ( length > 0 ){
+				line[ length ] = 0;
+				TtyPrintf( 0, "Read %s", line );
+			}
+		}
+		if ( ready & SELECT_MESSAGE ){
+			char message[ 32 ];
+			int from = Receive( message );
+			TtyPrintf( 0, "Message '%s' from %d\n", message, from );
+			Reply( message, from );
+		}
+		if ( ready & SELECT_CHILD ){
+			int status;
+			int pid = Wait( &status );
+			TtyPrintf( 0, "Child %d exited with %d\n", pid, status );
+			alive = 0;
+		}
+	}
+	return 0;
+}
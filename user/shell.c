@@ -3,6 +3,7 @@
 #include<stdio.h>
 #include<errno.h>
 #include "yalnix.h"
+#include "syscalls.h"
 
 #define MAX_LENGTH 1024  /* Should be long enough to hold any line */
 
@@ -51,28 +52,19 @@ main(int argc, char *argv[])
       }
       while(cmd_argv[j++] = strtok(NULL, separators))
 	;
-      if(pid = Fork())
+      if((pid = Spawn(cmd_argv[0], cmd_argv)) == -1)
 	{
-	  if(pid == -1)
-	    {
-	      printf("Shell: Cannot fork process\n");
-	      continue;
-	    }
-	  if ((pid = Wait(&res)) != -1) {
-	    fprintf(stderr, "PID %d exit status = %d\n", pid, res);
-	    TtyPrintf(termno, "PID %d exit status = %d\n", pid, res);
-	  }
-	  else {
-	    fprintf(stderr, "PID %d aborted by kernel.\n", pid);
-	    TtyPrintf(termno, "PID %d aborted by kernel.\n", pid);
-	  }
-	}
-      else
-	{
-	  Exec(cmd_argv[0], cmd_argv);
 	  TtyPrintf(termno, "Could not exec `%s'.\n", buf);
-	  Exit(-2);
+	  continue;
 	}
+      if ((pid = Wait(&res)) != -1) {
+	fprintf(stderr, "PID %d exit status = %d\n", pid, res);
+	TtyPrintf(termno, "PID %d exit status = %d\n", pid, res);
+      }
+      else {
+	fprintf(stderr, "PID %d aborted by kernel.\n", pid);
+	TtyPrintf(termno, "PID %d aborted by kernel.\n", pid);
+      }
     }
 }
 
@@ -0,0 +1,70 @@
+/* start a few threads that share a counter, then join them. then a child
+ * exits while one of its threads is blocked in Receive and the parent
+ * waits for it
+ */
+
+#include "yalnix.h"
+#include "syscalls.h"
+
+#define THREADS 3
+
+static int counter = 0;
+
+static void worker( int n ){
+	int i;
+	for ( i = 0; i < 3; i++ ){
+		counter += 1;
+		TtyPrintf( 0, "Thread %d of pid %d. counter %d\n", n, GetPid(), counter );
+		Delay( n + 1 );
+	}
+	ThreadExit( n );
+}
+
+/* nobody ever sends to this process, so this thread only goes away when
+ * its process exits
+ */
+static void receiver( int n ){
+	char message[ 32 ];
+	Receive( message );
+	TtyPrintf( 0, "Receiver thread got a message\n" );
+	ThreadExit( 0 );
+}
+
+static void exitWithBlockedThread(){
+	int status;
+	int pid = Fork();
+	if ( pid == 0 ){
+		if ( ThreadCreate( receiver, 0 ) == ERROR ){
+			TtyPrintf( 0, "Could not create receiver thread\n" );
+		}
+		/* let the thread block first */
+		Delay( 2 );
+		Exit( 5 );
+	}
+	if ( Wait( &status ) == pid ){
+		TtyPrintf( 0, "Child %d exited with %d\n", pid, status );
+	}
+}
+
+int main(){
+	int tids[ THREADS ];
+	int i;
+	for ( i = 0; i < THREADS; i++ ){
+		tids[ i ] = ThreadCreate( worker, i );
+		if ( tids[ i ] == ERROR ){
+			TtyPrintf( 0, "Could not create thread %d\n", i );
+		}
+	}
+
+	for ( i = 0; i < THREADS; i++ ){
+		int status;
+		if ( tids[ i ] != ERROR && ThreadJoin( tids[ i ], &status ) == 0 ){
+			TtyPrintf( 0, "Joined thread %d with status %d\n", tids[ i ], status );
+		}
+	}
+
+	TtyPrintf( 0, "Counter is %d\n", counter );
+
+	exitWithBlockedThread();
+	return 0;
+}
@@ -1,12 +1,13 @@
 /* $ time some-process
- * Shows how long some-process took to execute including time for fork and exec.
- * Useful for benchmarking how much load the os is under or just timing how long
- * a process took.
+ * Shows how long some-process took to execute and how that time splits into
+ * user, kernel and blocked time. Useful for benchmarking how much load the os
+ * is under or just timing how long a process took.
  */
 
 #include <stdlib.h>
 #include <sys/time.h>
 #include "yalnix.h"
+#include "syscalls.h"
 
 /* return time in microseconds */
 unsigned long long now(){
@@ -19,39 +20,36 @@ static void showTime( unsigned long long show ){
 	TtyPrintf( 0, "%f seconds / %f milliseconds\n", (double) show / ( 1000.0 * 1000.0 ), (double) show / 1000.0 );
 }
 
+/* print where the time of the reaped children went */
+static void showUsage(){
+	struct usage usage;
+	if ( GetRusage( USAGE_CHILDREN, &usage ) == ERROR ){
+		TtyPrintf( 0, "Could not get resource usage\n" );
+		return;
+	}
+	TtyPrintf( 0, "user    %f milliseconds\n", (double) usage.user_time / 1000.0 );
+	TtyPrintf( 0, "kernel  %f milliseconds\n", (double) usage.kernel_time / 1000.0 );
+	TtyPrintf( 0, "blocked %f milliseconds\n", (double) usage.blocked_time / 1000.0 );
+	TtyPrintf( 0, "faults %d syscalls %d messages %d sectors %d\n", usage.faults, usage.syscalls, usage.messages, usage.sectors );
+}
+
 int main( int argc, char ** argv ){
 	if ( argc > 1 ){
 		unsigned long long start;
 		start = now();
-		switch ( Fork() ){
-			/* child */
-			case 0 : {
-				char ** args = malloc( sizeof(char*) * argc - 1 + 1 );
-				int i;
-				if ( ! args ){
-					TtyPrintf( 0, "Could not malloc buffer for args\n" );
-					return -1;
-				}
-				for ( i = 1; i < argc; i++ ){
-					args[ i - 1 ] = argv[ i ];
-				}
-				args[ i - 1 ] = 0;
-				if ( Exec( args[ 0 ], args ) == ERROR ){
-					TtyPrintf( 0, "Could not exec %s\n", argv[ 1 ] );
-				}
-				break;
-			}
+		/* argv is null terminated so the tail of it is the child's argv */
+		switch ( Spawn( argv[ 1 ], argv + 1 ) ){
 			case ERROR : {
-				TtyPrintf( 0, "%s could not fork\n", argv[ 0 ] );
+				TtyPrintf( 0, "Could not exec %s\n", argv[ 1 ] );
 				break;
 			}
-			/* parent */
 			default : {
 				int status;
 
 				start = now();
 				if ( Wait( &status ) != ERROR ){
 					showTime( now() - start );
+					showUsage();
 					TtyPrintf( 0, "%s exited with status %d\n", argv[ 1 ], status );
 				} else {
 					TtyPrintf( 0, "%s died\n", argv[ 1 ] );